@@ -0,0 +1,169 @@
+/*
+ * CS 1550 Project 1: Double-Buffered Graphics Library
+ * Minimal compositor driver, a few forked clients each own a strip of the screen
+ * Author: Michael Korst (mpk44@pitt.edu)
+ * Usage: compdemo [-c clients] [-f frames] [-H]
+ *   -c forks that many clients (default 4), -f has each submit that many frames (default 200)
+ *   -H composes into memory instead of /dev/fb0, with lines padded like some drivers pad
+ *      them, and checks the screen shows every client's last frame
+ * Clients repaint their whole strip in a new color every frame and hand it over with
+ * comp_submit_frame() while the parent composes as fast as it can, so frames are handed
+ * back and forth through the lock-free swap with both sides running at once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "compositor.h"
+
+#define DEMO_XRES 640       //headless screen size
+#define DEMO_YRES 480
+#define DEMO_PAD 64         //bytes of padding after each headless line
+
+//color of client i's frame f, never black so an unpainted pixel shows up
+color_t frame_color(int i, int f)
+{
+  return (color_t)(((i + 1) << 11) | (f & 0x7ff)) | 1;
+}
+
+void run_client(struct gfx_context* ctx, struct compositor* comp, int id, int i, int frames)
+{
+  struct comp_rect area = comp->surfaces[id].area;
+  int f, x, y;
+
+  for (f = 1; f <= frames; f++)
+  {
+    void* buf = comp_begin_frame(comp, id);
+    for (y = area.y; y < area.y + area.h; y++)
+    {
+      for (x = area.x; x < area.x + area.w; x++)
+      {
+        gfx_draw_pixel(ctx, buf, x, y, frame_color(i, f));
+      }
+    }
+    comp_submit_frame(comp, id, area.x, area.y, area.w, area.h);
+  }
+}
+
+//every pixel of every strip holds its client's last color, returns the number that do not
+long check_screen(struct gfx_context* ctx, struct compositor* comp, int* ids, int clients, int frames)
+{
+  long bad = 0;
+  int i, x, y;
+
+  for (i = 0; i < clients; i++)
+  {
+    struct comp_rect area = comp->surfaces[ids[i]].area;
+    for (y = area.y; y < area.y + area.h; y++)
+    {
+      color_t* line = (color_t*)((char*)ctx->fb_mem + y * comp->stride);
+      for (x = area.x; x < area.x + area.w; x++)
+      {
+        bad += line[x] != frame_color(i, frames);
+      }
+    }
+  }
+  return bad;
+}
+
+int main(int argc, char** argv)
+{
+  struct gfx_context ctx;
+  struct compositor* comp;
+  int ids[COMP_MAX_SURFACES];
+  int clients = 4;
+  int frames = 200;
+  int headless = 0;
+  int running, composed = 0;
+  long bad = 0;
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "c:f:H")) != -1)
+  {
+    switch (opt)
+    {
+      case 'c':
+        clients = atoi(optarg);
+        break;
+      case 'f':
+        frames = atoi(optarg);
+        break;
+      case 'H':
+        headless = 1;
+        break;
+      default:
+        clients = 0;
+        break;
+    }
+  }
+  if (clients < 1 || clients > COMP_MAX_SURFACES || frames < 1)
+  {
+    fprintf(stderr, "usage: compdemo [-c clients] [-f frames] [-H], 1 to %d clients\n", COMP_MAX_SURFACES);
+    return 1;
+  }
+
+  if (headless)
+  {
+    //a memory screen with padded lines, the hardware pitch must not leak into the layout
+    gfx_init_headless(&ctx, DEMO_XRES, DEMO_YRES);
+    ctx.bit_depth.line_length += DEMO_PAD;
+    ctx.screen_size = DEMO_YRES * ctx.bit_depth.line_length;
+    ctx.fb_mem = gfx_new_offscreen_buffer(&ctx);
+  } else if (gfx_init(&ctx, "/dev/fb0", GFX_NO_TERM) != 0)
+  {
+    perror("/dev/fb0");
+    return 1;
+  }
+  comp = comp_create(&ctx, clients);
+  if (comp == NULL)
+  {
+    fprintf(stderr, "compdemo: no memory for the compositor\n");
+    return 1;
+  }
+
+  //one vertical strip each, opened before forking so the parent knows where they are
+  for (i = 0; i < clients; i++)
+  {
+    int w = comp->xres / clients;
+    ids[i] = comp_open_surface(comp, i, i * w, 0, w, comp->yres);
+    if (fork() == 0)
+    {
+      run_client(&ctx, comp, ids[i], i, frames);
+      _exit(0);
+    }
+  }
+
+  running = clients;
+  while (running > 0)
+  {
+    composed += comp_compose(&ctx, comp);
+    while (running > 0 && waitpid(-1, NULL, WNOHANG) > 0)
+    {
+      running--;
+    }
+  }
+  composed += comp_compose(&ctx, comp);     //last frames submitted after our previous pass
+
+  if (headless)
+  {
+    bad = check_screen(&ctx, comp, ids, clients, frames);
+  }
+  printf("%d clients, %d frames submitted, %d composed", clients, clients * frames, composed);
+  if (headless)
+  {
+    printf(", %ld pixels wrong", bad);
+  }
+  printf("\n");
+
+  for (i = 0; i < clients; i++)
+  {
+    comp_close_surface(comp, ids[i]);
+  }
+  comp_compose(&ctx, comp);                 //repaint the strips as empty
+  comp_destroy(comp);
+  gfx_exit(&ctx);
+  return bad != 0;
+}
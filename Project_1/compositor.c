@@ -0,0 +1,297 @@
+/*
+ * CS 1550 Project 1: Double-Buffered Graphics Library
+ * Shared-memory compositor for multiple rendering processes
+ * Author: Michael Korst (mpk44@pitt.edu)
+ *
+ * The compositor process calls comp_create() after gfx_init() and then forks
+ * its clients, which inherit the MAP_SHARED arena. Each client surface is triple
+ * buffered: the client draws into its back buffer and swaps it with the pending
+ * buffer using a single compare-and-swap, the compositor swaps pending with its
+ * front buffer the same way. No pixels are copied on handoff and nobody blocks.
+ * Every submitted frame must hold the full contents of the surface's area, since
+ * the compositor may repaint any part of it when a surface above or below changes.
+ * compdemo.c is a minimal compositor with a few forked clients.
+ */
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include "compositor.h"
+
+#define PENDING_IDX 0x3         //mask for buffer index in handoff word
+#define PENDING_FRESH 0x4       //pending buffer holds a frame the compositor has not seen
+
+static int rect_empty(struct comp_rect r)
+{
+  return r.w <= 0 || r.h <= 0;
+}
+
+//smallest rect covering both, empty rects are ignored
+static struct comp_rect rect_union(struct comp_rect a, struct comp_rect b)
+{
+  struct comp_rect u;
+  int right, bottom;
+
+  if (rect_empty(a))
+  {
+    return b;
+  }
+  if (rect_empty(b))
+  {
+    return a;
+  }
+  u.x = a.x < b.x ? a.x : b.x;
+  u.y = a.y < b.y ? a.y : b.y;
+  right = (a.x + a.w) > (b.x + b.w) ? (a.x + a.w) : (b.x + b.w);
+  bottom = (a.y + a.h) > (b.y + b.h) ? (a.y + a.h) : (b.y + b.h);
+  u.w = right - u.x;
+  u.h = bottom - u.y;
+  return u;
+}
+
+static struct comp_rect rect_intersect(struct comp_rect a, struct comp_rect b)
+{
+  struct comp_rect i;
+  int right, bottom;
+
+  i.x = a.x > b.x ? a.x : b.x;
+  i.y = a.y > b.y ? a.y : b.y;
+  right = (a.x + a.w) < (b.x + b.w) ? (a.x + a.w) : (b.x + b.w);
+  bottom = (a.y + a.h) < (b.y + b.h) ? (a.y + a.h) : (b.y + b.h);
+  i.w = right - i.x;
+  i.h = bottom - i.y;
+  if (rect_empty(i))
+  {
+    i.w = 0;
+    i.h = 0;
+  }
+  return i;
+}
+
+static struct comp_rect screen_rect(struct compositor* comp)
+{
+  struct comp_rect r;
+  r.x = 0;
+  r.y = 0;
+  r.w = comp->xres;
+  r.h = comp->yres;
+  return r;
+}
+
+//atomically replace the handoff word, returns its old value
+static unsigned int swap_pending(struct comp_surface* s, unsigned int new_val)
+{
+  unsigned int old;
+  //full barrier on success, so all pixel and damage writes land before the swap
+  do
+  {
+    old = s->pending;
+  }
+  while (__sync_val_compare_and_swap(&s->pending, old, new_val) != old);
+  return old;
+}
+
+static char* surface_buf(struct compositor* comp, struct comp_surface* s, int idx)
+{
+  return (char*)comp + s->buf_offset[idx];
+}
+
+struct compositor* comp_create(struct gfx_context* ctx, int max_surfaces)
+{
+  struct compositor* comp;
+  size_t header, arena;
+  size_t stride = ctx->virt_res.xres_virtual * sizeof(color_t);
+  int i, j;
+
+  if (max_surfaces <= 0 || max_surfaces > COMP_MAX_SURFACES)
+  {
+    return NULL;
+  }
+  //header rounded up to a page so each buffer starts page aligned
+  header = (sizeof(struct compositor) + 4095) & ~(size_t)4095;
+  arena = header + (size_t)max_surfaces * COMP_NUM_BUFS * ctx->screen_size + stride;
+
+  //shared and anonymous, clients forked after this see the same pages
+  comp = (struct compositor*)mmap(NULL, arena, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (comp == MAP_FAILED)
+  {
+    return NULL;
+  }
+  comp->arena_size = arena;
+  comp->max_surfaces = max_surfaces;
+  comp->buf_size = ctx->screen_size;
+  comp->row_offset = arena - stride;
+  comp->xres = ctx->virt_res.xres_virtual;
+  comp->yres = ctx->virt_res.yres_virtual;
+  comp->stride = stride;
+  for (i = 0; i < max_surfaces; i++)
+  {
+    for (j = 0; j < COMP_NUM_BUFS; j++)
+    {
+      comp->surfaces[i].buf_offset[j] = header + ((size_t)i * COMP_NUM_BUFS + j) * ctx->screen_size;
+    }
+  }
+  return comp;
+}
+
+void comp_destroy(struct compositor* comp)
+{
+  munmap(comp, comp->arena_size);
+}
+
+//claim a free slot for a client surface covering (x,y,w,h), returns surface id or -1
+int comp_open_surface(struct compositor* comp, int z, int x, int y, int w, int h)
+{
+  int i;
+  struct comp_rect area;
+
+  area.x = x;
+  area.y = y;
+  area.w = w;
+  area.h = h;
+  area = rect_intersect(area, screen_rect(comp));
+  if (rect_empty(area))
+  {
+    return -1;
+  }
+
+  for (i = 0; i < comp->max_surfaces; i++)
+  {
+    struct comp_surface* s = &comp->surfaces[i];
+    if (__sync_bool_compare_and_swap(&s->active, COMP_FREE, COMP_CLAIMING))
+    {
+      s->z = z;
+      s->area = area;
+      s->back = 0;
+      s->pending = 1;                 //pending starts as buffer 1, nothing fresh yet
+      s->front = 2;
+      s->carry.w = 0;
+      s->carry.h = 0;
+      memset(surface_buf(comp, s, 2), 0, comp->buf_size);
+      __sync_synchronize();           //publish slot fields before the compositor can see it
+      s->active = COMP_ACTIVE;
+      return i;
+    }
+  }
+  return -1;        //no free slots
+}
+
+//client is finished, compositor repaints what was underneath on its next pass
+void comp_close_surface(struct compositor* comp, int id)
+{
+  __sync_bool_compare_and_swap(&comp->surfaces[id].active, COMP_ACTIVE, COMP_CLOSING);
+}
+
+//buffer the client should draw its next frame into, usable with draw_pixel() and friends
+void* comp_begin_frame(struct compositor* comp, int id)
+{
+  struct comp_surface* s = &comp->surfaces[id];
+  return surface_buf(comp, s, s->back);
+}
+
+//hand the back buffer to the compositor, (x,y,w,h) is the part that changed
+void comp_submit_frame(struct compositor* comp, int id, int x, int y, int w, int h)
+{
+  struct comp_surface* s = &comp->surfaces[id];
+  struct comp_rect damage;
+  unsigned int old;
+
+  damage.x = x;
+  damage.y = y;
+  damage.w = w;
+  damage.h = h;
+  damage = rect_intersect(damage, s->area);
+  //also cover the last frame in case the compositor drops it for this one
+  s->damage[s->back] = rect_union(damage, s->carry);
+
+  old = swap_pending(s, s->back | PENDING_FRESH);
+  if (old & PENDING_FRESH)
+  {
+    //previous frame was never composed, its damage rides along with this one
+    s->carry = s->damage[s->back];
+  } else
+  {
+    s->carry = damage;
+  }
+  s->back = old & PENDING_IDX;
+}
+
+//pick up new frames and repaint the damaged region in z order, returns frames composed
+int comp_compose(struct gfx_context* ctx, struct compositor* comp)
+{
+  int order[COMP_MAX_SURFACES];
+  int count = 0;
+  int frames = 0;
+  struct comp_rect region;
+  char* row = (char*)comp + comp->row_offset;
+  int i, j, y;
+
+  region.w = 0;
+  region.h = 0;
+
+  for (i = 0; i < comp->max_surfaces; i++)
+  {
+    struct comp_surface* s = &comp->surfaces[i];
+    int state = s->active;
+
+    if (state == COMP_CLOSING)
+    {
+      region = rect_union(region, s->area);
+      __sync_synchronize();
+      s->active = COMP_FREE;          //slot may be reused from here on
+      continue;
+    }
+    if (state != COMP_ACTIVE)
+    {
+      continue;
+    }
+    if (s->pending & PENDING_FRESH)
+    {
+      unsigned int old = swap_pending(s, s->front);
+      s->front = old & PENDING_IDX;
+      region = rect_union(region, s->damage[s->front]);
+      frames++;
+    }
+
+    //insertion sort by z so lower surfaces are painted first
+    j = count++;
+    while (j > 0 && comp->surfaces[order[j - 1]].z > s->z)
+    {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = i;
+  }
+
+  region = rect_intersect(region, screen_rect(comp));
+  if (rect_empty(region))
+  {
+    return frames;
+  }
+
+  //build each row of the damaged region in scratch, then write it to the framebuffer once
+  for (y = region.y; y < region.y + region.h; y++)
+  {
+    size_t line = (size_t)y * comp->stride;
+    size_t left = (size_t)region.x * sizeof(color_t);
+
+    memset(row + left, 0, (size_t)region.w * sizeof(color_t));
+    for (i = 0; i < count; i++)
+    {
+      struct comp_surface* s = &comp->surfaces[order[i]];
+      int start = s->area.x > region.x ? s->area.x : region.x;
+      int end = (s->area.x + s->area.w) < (region.x + region.w) ? (s->area.x + s->area.w) : (region.x + region.w);
+
+      if (y < s->area.y || y >= s->area.y + s->area.h || start >= end)
+      {
+        continue;
+      }
+      memcpy(row + start * sizeof(color_t), surface_buf(comp, s, s->front) + line + start * sizeof(color_t),
+             (size_t)(end - start) * sizeof(color_t));
+    }
+    memcpy((char*)ctx->fb_mem + line + left, row + left, (size_t)region.w * sizeof(color_t));
+  }
+  return frames;
+}
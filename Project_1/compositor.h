@@ -0,0 +1,72 @@
+/*
+ * CS 1550 Project 1: Double-Buffered Graphics Library
+ * Shared-memory compositor for multiple rendering processes
+ * Author: Michael Korst (mpk44@pitt.edu)
+ */
+
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include "graphics.h"
+
+#define COMP_MAX_SURFACES 16      //max number of client surfaces one compositor tracks
+#define COMP_NUM_BUFS 3           //triple buffered: client back, pending handoff, compositor front
+
+//rectangle in screen coordinates, w or h of 0 means empty
+struct comp_rect
+{
+  int x;
+  int y;
+  int w;
+  int h;
+};
+
+//one client surface, lives entirely in MAP_SHARED memory
+struct comp_surface
+{
+  volatile int active;              //slot state, one of the COMP_ values below
+  int z;                            //stacking order, higher drawn on top
+  struct comp_rect area;            //part of the screen this surface owns
+  //handoff word, bits 0-1 index of pending buffer, bit 2 set when pending holds a new frame
+  volatile unsigned int pending;
+  int back;                         //buffer the client is drawing into, client owned
+  struct comp_rect carry;           //damage that may not have reached the screen yet, client owned
+  int front;                        //buffer the compositor reads from, compositor owned
+  struct comp_rect damage[COMP_NUM_BUFS];   //damage submitted with each buffer
+  size_t buf_offset[COMP_NUM_BUFS];         //offsets of each buffer from start of shared arena
+};
+
+//values for comp_surface.active
+#define COMP_FREE 0
+#define COMP_ACTIVE 1
+#define COMP_CLOSING 2              //client is done, compositor must repaint its area
+#define COMP_CLAIMING 3             //client is initializing the slot
+
+//shared arena header, followed by the surface pixel buffers
+struct compositor
+{
+  size_t arena_size;                //total bytes mapped
+  int max_surfaces;                 //number of usable entries in surfaces[]
+  size_t buf_size;                  //bytes per surface buffer, same as one screen
+  size_t row_offset;                //offset of the compositor's scratch row
+  int xres;                         //screen geometry copied from the context at creation
+  int yres;
+  size_t stride;                    //bytes per row in surface buffers and on screen, as gfx_draw_pixel() lays them out
+  struct comp_surface surfaces[COMP_MAX_SURFACES];
+};
+
+struct compositor* comp_create(struct gfx_context* ctx, int max_surfaces);
+
+void comp_destroy(struct compositor* comp);
+
+int comp_open_surface(struct compositor* comp, int z, int x, int y, int w, int h);
+
+void comp_close_surface(struct compositor* comp, int id);
+
+void* comp_begin_frame(struct compositor* comp, int id);
+
+void comp_submit_frame(struct compositor* comp, int id, int x, int y, int w, int h);
+
+int comp_compose(struct gfx_context* ctx, struct compositor* comp);
+
+#endif
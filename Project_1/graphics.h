@@ -4,18 +4,76 @@
  * Author: Michael Korst (mpk44@pitt.edu)
  */
 
+#ifndef GRAPHICS_H
+#define GRAPHICS_H
+
+#include <linux/fb.h>
+#include <termios.h>
+
 //macro to encode color in 16 bit value
 #define RGB(r, g, b) ((color_t) ((r & 0x1f) << 11) | ((g & 0x3f) << 5) | (b & 0x1f))
 
   //typedef to make 16-bit unsigned val for color type
 typedef unsigned short color_t;
 
+#define GFX_NO_TERM 0x1       //flag for gfx_init(), leave the terminal alone (for extra heads)
+#define GFX_HEADLESS 0x2      //set by gfx_init_headless(), no frame buffer device
+
+//all state for one framebuffer, one per head or per rendering thread
+struct gfx_context
+{
+  int fb_desc;                          //frame buffer file descriptor
+  void* fb_mem;                         //pointer to fb in memory
+  int screen_size;                      //size of mmapped fb indicating size of display
+  struct fb_var_screeninfo virt_res;    //stores virtual resolution struct
+  struct fb_fix_screeninfo bit_depth;   //stores bit depth struct
+  struct termios term_settings;         //stores terminal settings
+  int flags;                            //GFX_ flags passed to gfx_init()
+};
+
+int gfx_init(struct gfx_context* ctx, const char* device, int flags);
+
+void gfx_init_headless(struct gfx_context* ctx, int xres, int yres);
+
+void gfx_exit(struct gfx_context* ctx);
+
+void gfx_clear_screen(struct gfx_context* ctx, void* img);
+
+void gfx_draw_pixel(struct gfx_context* ctx, void* img, int x, int y, color_t color);
+
+void gfx_draw_line(struct gfx_context* ctx, void* img, int x1, int y1, int x2, int y2, color_t c);
+
+void* gfx_new_offscreen_buffer(struct gfx_context* ctx);
+
+void gfx_blit(struct gfx_context* ctx, void* src);
+
+void gfx_blit_rect(struct gfx_context* ctx, void* src, int x, int y, int w, int h);
+
+struct gfx_context* gfx_default_context();
+
+//original API, operates on the default context for /dev/fb0
+
 void init_graphics();
 
 void exit_graphics();
 
 char getkey();
 
+#define INPUT_REPLAY_TIMED 0    //getkey() replays keys with their recorded spacing
+#define INPUT_REPLAY_FAST 1     //getkey() replays keys back to back with no waiting
+
+int input_record(const char* path);
+
+int input_replay(const char* path, int mode);
+
+void input_stop();
+
+int poll_key(char* key);
+
+void input_advance(long long us);
+
+long long time_us();
+
 void sleep_ms(long ms);
 
 void clear_screen(void* img);
@@ -27,3 +85,7 @@ void draw_line(void* img, int x1, int y1, int x2, int y2, color_t c);
 void* new_offscreen_buffer();
 
 void blit(void* src);
+
+void blit_rect(void* src, int x, int y, int w, int h);
+
+#endif
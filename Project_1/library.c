@@ -5,7 +5,8 @@
  */
 
 #include <fcntl.h>
-#include <linux/fb.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/select.h>
@@ -17,48 +18,202 @@
 
 #include "graphics.h"
 
-int fb_desc;          //frame buffer file descriptor
-void* fb_mem;    //pointer to fb in memory
-int screen_size;       //size of mmapped fb indicating size of display
-struct fb_var_screeninfo virt_res;     //stores virtual resolution struct
-struct fb_fix_screeninfo bit_depth;    //stores bit depth struct
-struct termios term_settings;         //stores terminal settings
+static struct gfx_context default_ctx;      //context behind the original API
 
+//input record/replay state, input is per process so this stays out of the context
+static FILE* record_file = NULL;      //events from getkey() are appended here when recording
+static FILE* replay_file = NULL;      //getkey() reads events from here instead of stdin when replaying
+static int replay_mode;               //INPUT_REPLAY_TIMED or INPUT_REPLAY_FAST
+static long long input_start_us;      //time recording or replay began, getkey() times are relative to it
+static long long input_clock_us;      //simulation time advanced by input_advance(), poll_key() times use it
+static int have_event = 0;            //1 when a replay event has been read but not yet delivered
+static long long event_when;          //time stamp of that event
+static int event_key;                 //key code of that event
 
-void init_graphics()
+struct gfx_context* gfx_default_context()
+{
+  return &default_ctx;
+}
+
+//open and map a framebuffer device into ctx, returns 0 on success and -1 on failure
+int gfx_init(struct gfx_context* ctx, const char* device, int flags)
 {
-  fb_desc = open("/dev/fb0", O_RDWR);    //retrieve fb descriptor
+  ctx->flags = flags;
+  ctx->fb_desc = open(device, O_RDWR);    //retrieve fb descriptor
+  if (ctx->fb_desc < 0)
+  {
+    return -1;
+  }
   //retrieves and stores structs for virtual res and bit depth
-  ioctl(fb_desc, FBIOGET_VSCREENINFO, &virt_res);
-  ioctl(fb_desc, FBIOGET_FSCREENINFO, &bit_depth);
+  ioctl(ctx->fb_desc, FBIOGET_VSCREENINFO, &ctx->virt_res);
+  ioctl(ctx->fb_desc, FBIOGET_FSCREENINFO, &ctx->bit_depth);
   //calculate total size of mmapped file from struct fields
-  screen_size = virt_res.yres_virtual * bit_depth.line_length;
+  ctx->screen_size = ctx->virt_res.yres_virtual * ctx->bit_depth.line_length;
   //maps frame buffer in memory, stores pointer to address space
-  fb_mem = mmap(NULL, screen_size, PROT_READ | PROT_WRITE, MAP_SHARED, fb_desc, 0);
+  ctx->fb_mem = mmap(NULL, ctx->screen_size, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->fb_desc, 0);
+  if (ctx->fb_mem == MAP_FAILED)
+  {
+    close(ctx->fb_desc);
+    return -1;
+  }
+  if (flags & GFX_NO_TERM)
+  {
+    return 0;       //another context owns the terminal
+  }
   //clear out the terminal screen for new frame Buffer, write clear command to std out 4 bytes
   write(STDOUT_FILENO, "\033[2J", 4);
   write(0, "\033[?25l", 7);               //remove cursor
-  ioctl(STDIN_FILENO, TCGETS, &term_settings);   //retrive curr term term_settings
-  term_settings.c_lflag &= ~ICANON;             //disable canonical mode
-  term_settings.c_lflag &= ~ECHO;             //disable echo
-  ioctl(STDIN_FILENO, TCSETS, &term_settings);   //passes new term term_settings
+  ioctl(STDIN_FILENO, TCGETS, &ctx->term_settings);   //retrive curr term term_settings
+  ctx->term_settings.c_lflag &= ~ICANON;             //disable canonical mode
+  ctx->term_settings.c_lflag &= ~ECHO;             //disable echo
+  ioctl(STDIN_FILENO, TCSETS, &ctx->term_settings);   //passes new term term_settings
+  return 0;
 }
 
-void exit_graphics()
+//set up ctx with no device behind it, offscreen buffers and drawing work but blits do nothing
+void gfx_init_headless(struct gfx_context* ctx, int xres, int yres)
+{
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->flags = GFX_HEADLESS | GFX_NO_TERM;
+  ctx->fb_desc = -1;
+  ctx->fb_mem = NULL;
+  ctx->virt_res.xres_virtual = xres;
+  ctx->virt_res.yres_virtual = yres;
+  ctx->bit_depth.line_length = xres * sizeof(color_t);
+  ctx->screen_size = yres * ctx->bit_depth.line_length;
+}
+
+void gfx_exit(struct gfx_context* ctx)
 {
+  if (ctx->flags & GFX_HEADLESS)
+  {
+    return;         //nothing mapped or changed
+  }
+  munmap(ctx->fb_mem, ctx->screen_size);    //unmap frame buffer from memory
+  close(ctx->fb_desc);         //close frame buffer descriptor
+  if (ctx->flags & GFX_NO_TERM)
+  {
+    return;
+  }
   write(STDOUT_FILENO, "\033[2J", 4);    //clear term at exit
   write(0, "\033[?25h", 7);               //re-enable cursor
-  munmap(fb_mem, screen_size);    //unmap frame buffer from memory
-  close(fb_desc);         //close frame buffer descriptor
-  term_settings.c_lflag |= ICANON;    //re-enable canonical mode
-  term_settings.c_lflag |= ECHO;      //re-enable echo
-  ioctl(STDIN_FILENO, TCSETS, &term_settings);    //pass reset term settings
+  ctx->term_settings.c_lflag |= ICANON;    //re-enable canonical mode
+  ctx->term_settings.c_lflag |= ECHO;      //re-enable echo
+  ioctl(STDIN_FILENO, TCSETS, &ctx->term_settings);    //pass reset term settings
+}
+
+void init_graphics()
+{
+  gfx_init(&default_ctx, "/dev/fb0", 0);
+}
+
+void exit_graphics()
+{
+  input_stop();
+  gfx_exit(&default_ctx);
+}
+
+//monotonic clock in microseconds, wall clock jumps must not distort replay timing
+long long time_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//log every key getkey() returns as "<microseconds> <key code>" lines, returns 0 on success
+int input_record(const char* path)
+{
+  input_stop();
+  record_file = fopen(path, "w");
+  if (record_file == NULL)
+  {
+    return -1;
+  }
+  input_start_us = time_us();
+  input_clock_us = 0;
+  return 0;
+}
+
+//feed getkey() from a recording instead of stdin, returns 0 on success
+int input_replay(const char* path, int mode)
+{
+  input_stop();
+  replay_file = fopen(path, "r");
+  if (replay_file == NULL)
+  {
+    return -1;
+  }
+  replay_mode = mode;
+  input_start_us = time_us();
+  input_clock_us = 0;
+  return 0;
+}
+
+//finish any recording or replay, getkey() goes back to reading stdin
+void input_stop()
+{
+  if (record_file != NULL)
+  {
+    fclose(record_file);
+    record_file = NULL;
+  }
+  if (replay_file != NULL)
+  {
+    fclose(replay_file);
+    replay_file = NULL;
+  }
+  have_event = 0;
+}
+
+//move the simulation clock forward, drivers call this once per fixed tick
+void input_advance(long long us)
+{
+  input_clock_us += us;
+}
+
+//read the next replay event into the pending slot, returns 0 once the recording runs out
+static int next_event()
+{
+  if (!have_event)
+  {
+    have_event = fscanf(replay_file, "%lld %d", &event_when, &event_key) == 2;
+  }
+  return have_event;
+}
+
+//next key from the replay file, 'q' once the recording runs out so drivers exit cleanly
+static char replay_key()
+{
+  if (!next_event())
+  {
+    return 'q';
+  }
+  have_event = 0;
+  if (replay_mode == INPUT_REPLAY_TIMED)
+  {
+    long long wait = input_start_us + event_when - time_us();
+    if (wait > 0)
+    {
+      struct timespec sleep_time;
+      sleep_time.tv_sec = wait / 1000000;
+      sleep_time.tv_nsec = (wait % 1000000) * 1000;
+      nanosleep(&sleep_time, NULL);
+    }
+  }
+  return (char)event_key;
 }
 
 //function that waits keypress and reads if it arrives
 char getkey()
 {
   char key;       //character to return
+
+  if (replay_file != NULL)
+  {
+    return replay_key();        //same input path, recorded source
+  }
+
   fd_set fds;     //set of all open file descriptors, pass to select()
   FD_ZERO(&fds);      //clear fd set to ensure accurate reading
   FD_SET(STDIN_FILENO, &fds);     //add stdin to descriptor set to listen
@@ -68,9 +223,51 @@ char getkey()
   {
     read(STDIN_FILENO, &key, 1);
   }
+  if (record_file != NULL)
+  {
+    fprintf(record_file, "%lld %d\n", time_us() - input_start_us, key);
+  }
   return key;
 }
 
+//non-blocking read of one key, returns 1 and stores it in key if one was waiting
+//recorded and replayed against the simulation clock so a replay lands on the same ticks
+int poll_key(char* key)
+{
+  fd_set fds;
+  struct timeval no_wait;
+
+  if (replay_file != NULL)
+  {
+    if (!next_event())
+    {
+      *key = 'q';                 //recording over, ask the driver to quit
+      return 1;
+    }
+    if (event_when > input_clock_us)
+    {
+      return 0;                   //not due yet
+    }
+    have_event = 0;
+    *key = (char)event_key;
+    return 1;
+  }
+
+  FD_ZERO(&fds);
+  FD_SET(STDIN_FILENO, &fds);
+  no_wait.tv_sec = 0;           //zero timeout turns select() into a poll
+  no_wait.tv_usec = 0;
+  if (select(STDIN_FILENO + 1, &fds, NULL, NULL, &no_wait) <= 0 || read(STDIN_FILENO, key, 1) != 1)
+  {
+    return 0;
+  }
+  if (record_file != NULL)
+  {
+    fprintf(record_file, "%lld %d\n", input_clock_us, *key);
+  }
+  return 1;
+}
+
 void sleep_ms(long ms)
 {
   struct timespec sleep_time;     //struct to hold sleep time
@@ -81,32 +278,32 @@ void sleep_ms(long ms)
 }
 
 //copy over each byte with value 0 to blank buffer
-void clear_screen(void* img)
+void gfx_clear_screen(struct gfx_context* ctx, void* img)
 {
   size_t i;
   //iterate through all bytes in buffer to blank
-  for (i = 0; i < screen_size; i++)
+  for (i = 0; i < ctx->screen_size; i++)
   {
     *((char*)(img) + i) = 0; //must cast to char* to access byte-wise, dereference and set to 0
   }
 }
 
-void draw_pixel(void* img, int x, int y, color_t color)
+void gfx_draw_pixel(struct gfx_context* ctx, void* img, int x, int y, color_t color)
 {
-  if (x < 0 || y < 0 || x > virt_res.xres_virtual || y > virt_res.yres_virtual)
+  if (x < 0 || y < 0 || x > ctx->virt_res.xres_virtual || y > ctx->virt_res.yres_virtual)
   {
     return;       //pixel out of bounds, return as invalid
   }
 
   //calculate pixel offset  to use in pointer arithmetic
-  int offset = (y * virt_res.xres_virtual) + x;
+  int offset = (y * ctx->virt_res.xres_virtual) + x;
   color_t* pixel = (color_t*)img + offset;     //find pixel in memory
   *pixel = color;     //set color
 }
 
 //employ Bresenham's algorithm to draw line with draw_pixel()
 // used http://citeseerx.ist.psu.edu/viewdoc/download?doi=10.1.1.616.2235&rep=rep1&type=pdf
-void draw_line(void* img, int x1, int y1, int x2, int y2, color_t c)
+void gfx_draw_line(struct gfx_context* ctx, void* img, int x1, int y1, int x2, int y2, color_t c)
 {
   int delta_x = x2 - x1;
   int delta_y = y2 - y1;
@@ -132,7 +329,7 @@ void draw_line(void* img, int x1, int y1, int x2, int y2, color_t c)
  		two_dy *= -1;
  	}
 
- 	draw_pixel(img, x1, y1, c);							//always draw 1st point
+ 	gfx_draw_pixel(ctx, img, x1, y1, c);							//always draw 1st point
 
  	if (delta_x != 0 || delta_y != 0)					//other points on the line?
  	{
@@ -148,7 +345,7 @@ void draw_line(void* img, int x1, int y1, int x2, int y2, color_t c)
  					curr_y += y_inc;
  					two_dx_error -= two_dx;
  				}
- 				draw_pixel(img, curr_x, curr_y, c);
+ 				gfx_draw_pixel(ctx, img, curr_x, curr_y, c);
  			}
  		} else					//slope large, reverse roles of x & y
  		{
@@ -162,26 +359,97 @@ void draw_line(void* img, int x1, int y1, int x2, int y2, color_t c)
  					curr_x += x_inc;
  					two_dy_error -= two_dy;
  				}
- 				draw_pixel(img, curr_x, curr_y, c);
+ 				gfx_draw_pixel(ctx, img, curr_x, curr_y, c);
  			}
  		}
  	}
 }
 
-void* new_offscreen_buffer()
+void* gfx_new_offscreen_buffer(struct gfx_context* ctx)
 {
-	void* new_buf = mmap(NULL, screen_size, PROT_READ | PROT_WRITE,
+	void* new_buf = mmap(NULL, ctx->screen_size, PROT_READ | PROT_WRITE,
 											MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);					//allocate new frame buffer
 	return new_buf;
 }
 
 //iterate through bytes of src and copy to frame buffer
-void blit(void* src)
+void gfx_blit(struct gfx_context* ctx, void* src)
 {
 	size_t i;
 
-	for (i = 0; i < screen_size; i++)
+	if (ctx->fb_mem == NULL)
 	{
-		*((char*)fb_mem + i) = *((char*)src + i);			//must cast to char* to access byte-wise
+		return;				//headless, no frame buffer
 	}
+	for (i = 0; i < ctx->screen_size; i++)
+	{
+		*((char*)ctx->fb_mem + i) = *((char*)src + i);			//must cast to char* to access byte-wise
+	}
+}
+
+//copy only the (x,y,w,h) rectangle of src to the frame buffer, for damage-driven updates
+//rows are xres_virtual pixels apart in both, as gfx_draw_pixel() and gfx_blit() lay them out
+void gfx_blit_rect(struct gfx_context* ctx, void* src, int x, int y, int w, int h)
+{
+  size_t stride = ctx->virt_res.xres_virtual * sizeof(color_t);
+  int row;
+
+  if (x < 0)       //clip rectangle to the visible screen
+  {
+    w += x;
+    x = 0;
+  }
+  if (y < 0)
+  {
+    h += y;
+    y = 0;
+  }
+  if (x + w > (int)ctx->virt_res.xres_virtual)
+  {
+    w = ctx->virt_res.xres_virtual - x;
+  }
+  if (y + h > (int)ctx->virt_res.yres_virtual)
+  {
+    h = ctx->virt_res.yres_virtual - y;
+  }
+  if (w <= 0 || h <= 0 || ctx->fb_mem == NULL)
+  {
+    return;
+  }
+
+  for (row = y; row < y + h; row++)
+  {
+    size_t offset = (size_t)row * stride + x * sizeof(color_t);
+    memcpy((char*)ctx->fb_mem + offset, (char*)src + offset, w * sizeof(color_t));
+  }
+}
+
+void clear_screen(void* img)
+{
+	gfx_clear_screen(&default_ctx, img);
+}
+
+void draw_pixel(void* img, int x, int y, color_t color)
+{
+	gfx_draw_pixel(&default_ctx, img, x, y, color);
+}
+
+void draw_line(void* img, int x1, int y1, int x2, int y2, color_t c)
+{
+	gfx_draw_line(&default_ctx, img, x1, y1, x2, y2, c);
+}
+
+void* new_offscreen_buffer()
+{
+	return gfx_new_offscreen_buffer(&default_ctx);
+}
+
+void blit(void* src)
+{
+	gfx_blit(&default_ctx, src);
+}
+
+void blit_rect(void* src, int x, int y, int w, int h)
+{
+	gfx_blit_rect(&default_ctx, src, x, y, w, h);
 }
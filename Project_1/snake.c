@@ -3,8 +3,31 @@
  * Fall 2018
  * Author: Michael Korst (mpk44@pitt.edu)
  * Snake game to act as driver for graphics library
+ * Usage: snake [-r file | -p file | -f file] [-L len] [-O count] [-H ticks [-n N] [-s seed]] [-B]
+ *              [-W agents [-T threads]]
+ *   -r records key presses to file, -p replays them with original timing,
+ *   -f replays them as fast as possible for benchmark runs
+ *   -H runs headless for the given number of ticks as fast as possible, steered by
+ *      the replay file if one is given and by a seeded random agent otherwise,
+ *      -n renders every Nth tick into an offscreen buffer (0, the default, never renders)
+ *   -L sets the starting body length, -O scatters that many obstacle cells
+ *   -B benchmarks headless tick cost for snakes of 10 to 100,000 segments, not with -O
+ *   -W runs a headless world of that many agent snakes for -H ticks (default 1000),
+ *      stepped in parallel by -T threads (default one per online CPU)
+ * Snake body and obstacles are mirrored in a packed occupancy bitmap, so collision
+ * and food checks are O(1) per move and a move only flips the head and tail bits.
+ * The game runs on a fixed simulation tick with an accumulator, input is drained
+ * without blocking at the start of each tick and frames are drawn at display rate.
+ * Tick and render timing counters are printed to stderr on exit.
  */
 
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "graphics.h"
 #define UP 65             //macros to store ASCII arrow keys: A, B, C, D
 #define DOWN 66
@@ -13,88 +36,955 @@
 #define MAX_X 639         //valid x between 0 and 639
 #define MAX_Y 479         //valid y between 0 and 479
 
+#define GRID_W (MAX_X + 1)                    //playfield size in cells
+#define GRID_H (MAX_Y + 1)
+#define GRID_WORDS ((GRID_W * GRID_H + 31) / 32)  //32 cells per bitmap word
+
+#define SNAKE_LEN 64      //cells in the snake body once fully grown
+#define SNAKE_CAP 131072  //ring buffer capacity, power of 2 and > longest snake
+#define FOOD_GROWTH 16    //cells the snake grows by for each food eaten
+#define MAX_OBSTACLES 4096
+#define BENCH_TICKS 1000000     //measured ticks per length in the -B benchmark
+#define WORLD_LEN 8       //body length of each agent in world mode
+#define WORLD_CAP 8       //agent ring buffer capacity, power of 2 and >= WORLD_LEN
+#define WORLD_TICKS 1000  //default ticks for world mode
+#define NO_CLAIM UINT_MAX //claims entry for a cell nobody is moving into
+#define TICK_US 20000     //fixed simulation step, 50 ticks per second
+#define FRAME_US 16667    //display refresh period, about 60 frames per second
+#define MAX_CATCHUP 5     //most ticks run for one frame, older backlog is dropped
+#define DAMAGE_PER_TICK 2 //cells one tick changes, new head and vacated tail
+#define MAX_DAMAGE (GRID_W * GRID_H)    //a longer damage list costs more than repainting the board
+#define AGENT_TURN 16     //random agent turns on average once every this many ticks
+#define AGENT_LOOK 16     //how far ahead the agent checks for blocked cells
+
+//one cell of the playfield, one pixel per cell
+struct cell
+{
+  short x;
+  short y;
+  short kind;             //in damage lists, what the cell now holds
+};
+
+//cell kinds for damage lists
+#define CELL_EMPTY 0
+#define CELL_SNAKE 1
+#define CELL_FOOD 2
+#define CELL_WALL 3
+
 color_t snake_color = RGB(31, 33, 0);       //snake color set to orange
+color_t empty_color = RGB(0, 0, 0);         //background color
+color_t food_color = RGB(0, 63, 0);         //food is green
+color_t wall_color = RGB(16, 32, 16);       //obstacles are grey
 int curr_x = 0;         //x and y initial positions at (0,479) bottom left
 int curr_y = MAX_Y;
 
-void move_snake(void* img, int new_x, int new_y)
+struct cell body[SNAKE_CAP];      //ring buffer of body cells, head at body_head
+int body_head = 0;                //index of head cell in body
+int body_len = 0;                 //number of cells in use
+int target_len = SNAKE_LEN;       //length the snake grows to, raised by eating food
+int food_growth = FOOD_GROWTH;    //0 in the benchmark so the length stays fixed
+unsigned int blocked[GRID_WORDS]; //occupancy bitmap, bit set for snake body and obstacle cells
+struct cell obstacles[MAX_OBSTACLES];
+int num_obstacles = 0;
+struct cell food;                 //the one food cell on the board
+struct cell* damage;              //cells changed since the last frame
+int damage_cap = 0;               //room in damage, enough for every tick of one frame
+int num_damage = 0;
+int damage_overflow = 0;          //too many changes to list, next frame repaints everything
+int dir_x = 0;                    //current heading, snake sits still until the first arrow
+int dir_y = 0;
+int esc_state = 0;                //how much of an ESC [ <code> arrow sequence has been read
+unsigned int agent_seed = 1;      //state of the random agent, same seed gives the same run
+unsigned int world_seed = 1550;   //state for food and obstacle placement
+
+//timing counters for the game loop, all times in microseconds
+struct loop_stats
+{
+  long long ticks;
+  long long frames;
+  long long tick_time;            //total time spent in simulation ticks
+  long long render_time;          //total time spent drawing frames
+  long long max_tick;
+  long long max_render;
+  long long dropped;              //simulation time thrown away when the loop fell behind
+  long long deaths;               //collisions, headless runs respawn after each one
+} stats;
+
+int cell_blocked(int x, int y)
+{
+  unsigned int i = y * GRID_W + x;
+  return (blocked[i >> 5] >> (i & 31)) & 1;
+}
+
+void set_blocked(int x, int y)
+{
+  unsigned int i = y * GRID_W + x;
+  blocked[i >> 5] |= 1u << (i & 31);
+}
+
+void clear_blocked(int x, int y)
+{
+  unsigned int i = y * GRID_W + x;
+  blocked[i >> 5] &= ~(1u << (i & 31));
+}
+
+//xorshift, cheap and the same on every build for a given seed
+unsigned int next_rand(unsigned int* seed)
+{
+  *seed ^= *seed << 13;
+  *seed ^= *seed >> 17;
+  *seed ^= *seed << 5;
+  return *seed;
+}
+
+//add a cell to the frame's damage list
+void add_damage(int x, int y, int kind)
+{
+  if (num_damage == damage_cap)
+  {
+    damage_overflow = 1;
+    return;
+  }
+  damage[num_damage].x = x;
+  damage[num_damage].y = y;
+  damage[num_damage].kind = kind;
+  num_damage++;
+}
+
+//drop food on a random free cell, expected O(1) tries unless the board is nearly full
+void place_food()
 {
+  do
+  {
+    food.x = next_rand(&world_seed) % GRID_W;
+    food.y = next_rand(&world_seed) % GRID_H;
+  }
+  while (cell_blocked(food.x, food.y));
+  add_damage(food.x, food.y, CELL_FOOD);
+}
+
+void place_obstacles(int count)
+{
+  struct cell* o;
+
+  while (num_obstacles < count && num_obstacles < MAX_OBSTACLES)
+  {
+    o = &obstacles[num_obstacles];
+    o->x = next_rand(&world_seed) % GRID_W;
+    o->y = next_rand(&world_seed) % GRID_H;
+    if (cell_blocked(o->x, o->y) || (o->x == curr_x && o->y == curr_y))
+    {
+      continue;
+    }
+    set_blocked(o->x, o->y);
+    num_obstacles++;
+  }
+}
+
+//put a one cell snake at the start position, obstacles stay where they are
+void reset_snake()
+{
+  int i;
+
+  memset(blocked, 0, sizeof(blocked));
+  for (i = 0; i < num_obstacles; i++)
+  {
+    set_blocked(obstacles[i].x, obstacles[i].y);
+  }
+  curr_x = 0;
+  curr_y = MAX_Y;
+  body[body_head].x = curr_x;
+  body[body_head].y = curr_y;
+  body_len = 1;
+  set_blocked(curr_x, curr_y);
+  if (cell_blocked(food.x, food.y))
+  {
+    place_food();
+  }
+  damage_overflow = 1;          //whole board changed
+}
+
+//advance head one cell and vacate the tail once the body is full, game logic only
+//returns 1 if the snake ran into itself or an obstacle
+int move_snake(int new_x, int new_y)
+{
+  struct cell* tail;
+
   if (new_x > MAX_X)          //snake too far right, wrap around
   {
     new_x = 0;
-    curr_x = new_x;
   } else if (new_x < 0)       //snake too far left, wrap around
   {
     new_x = MAX_X;
-    curr_x = new_x;
   }
 
   if (new_y > MAX_Y)        //snake too far down, wrap around
   {
     new_y = 0;
-    curr_y = new_y;
   } else if (new_y < 0)     //snake too far down, wrap around
   {
     new_y = MAX_Y;
-    curr_y = new_y;
   }
-  //draw line between new points for snake movement
-  draw_line(img, curr_x, curr_y, new_x, new_y, snake_color);
+
+  //body at full length, vacate the tail cell first so the head may follow it
+  if (body_len >= target_len)
+  {
+    tail = &body[(body_head - (body_len - 1)) & (SNAKE_CAP - 1)];
+    clear_blocked(tail->x, tail->y);
+    add_damage(tail->x, tail->y, CELL_EMPTY);
+    body_len--;
+  }
+
+  if (cell_blocked(new_x, new_y))
+  {
+    return 1;               //hit body or obstacle
+  }
+
+  //push new head
+  body_head = (body_head + 1) & (SNAKE_CAP - 1);
+  body[body_head].x = new_x;
+  body[body_head].y = new_y;
+  body_len++;
+  set_blocked(new_x, new_y);
+  add_damage(new_x, new_y, CELL_SNAKE);
   curr_x = new_x;
   curr_y = new_y;
+
+  if (new_x == food.x && new_y == food.y)
+  {
+    target_len += food_growth;
+    if (target_len >= SNAKE_CAP)
+    {
+      target_len = SNAKE_CAP - 1;
+    }
+    place_food();
+  }
+  return 0;
+}
+
+color_t kind_color(int kind)
+{
+  switch (kind)
+  {
+    case CELL_SNAKE:
+      return snake_color;
+    case CELL_FOOD:
+      return food_color;
+    case CELL_WALL:
+      return wall_color;
+  }
+  return empty_color;
+}
+
+//bring img up to date with the game, only the damaged cells unless the list overflowed
+void draw_damage(void* img)
+{
+  int i;
+
+  if (damage_overflow)
+  {
+    clear_screen(img);
+    for (i = 0; i < num_obstacles; i++)
+    {
+      draw_pixel(img, obstacles[i].x, obstacles[i].y, wall_color);
+    }
+    draw_pixel(img, food.x, food.y, food_color);
+    for (i = 0; i < body_len; i++)
+    {
+      struct cell* c = &body[(body_head - i) & (SNAKE_CAP - 1)];
+      draw_pixel(img, c->x, c->y, snake_color);
+    }
+    return;
+  }
+  for (i = 0; i < num_damage; i++)
+  {
+    int kind = damage[i].kind;
+
+    //a vacated tail may be covered again by the time the frame is drawn, only erase it
+    //if the occupancy bitmap says nothing is there now, tails are never obstacles
+    if (kind == CELL_EMPTY && cell_blocked(damage[i].x, damage[i].y))
+    {
+      kind = CELL_SNAKE;
+    }
+    draw_pixel(img, damage[i].x, damage[i].y, kind_color(kind));
+  }
+}
+
+//copy just the cells changed this frame to the frame buffer
+void blit_damage(void* img)
+{
+  int i;
+
+  if (damage_overflow)
+  {
+    blit(img);
+  } else
+  {
+    for (i = 0; i < num_damage; i++)
+    {
+      blit_rect(img, damage[i].x, damage[i].y, 1, 1);
+    }
+  }
+  num_damage = 0;
+  damage_overflow = 0;
+}
+
+//feed one key through the arrow key parser, returns 1 if the user asked to quit
+int handle_key(char key)
+{
+  int new_x, new_y;
+
+  if (esc_state == 0)
+  {
+    if (key == 27)
+    {
+      esc_state = 1;        //ESC, start of ANSI sequence
+    }
+    return key == 'q';
+  }
+  if (esc_state == 1)
+  {
+    esc_state = (key == 91) ? 2 : 0;      //expect [ next
+    return 0;
+  }
+  esc_state = 0;
+  new_x = 0;
+  new_y = 0;
+  switch (key)
+  {
+    case UP:
+      new_y = -1;
+      break;
+    case DOWN:
+      new_y = 1;
+      break;
+    case RIGHT:
+      new_x = 1;
+      break;
+    case LEFT:
+      new_x = -1;
+      break;
+  }
+  //reversing would run straight into the neck, ignore it
+  if ((new_x != 0 || new_y != 0) && (body_len == 1 || new_x != -dir_x || new_y != -dir_y))
+  {
+    dir_x = new_x;
+    dir_y = new_y;
+  }
+  return 0;
+}
+
+//free cells straight ahead of (x,y) in direction (dx,dy), looking at most AGENT_LOOK cells
+int free_run(int x, int y, int dx, int dy)
+{
+  int n;
+
+  for (n = 0; n < AGENT_LOOK; n++)
+  {
+    x = (x + dx + GRID_W) % GRID_W;
+    y = (y + dy + GRID_H) % GRID_H;
+    if (cell_blocked(x, y))
+    {
+      break;
+    }
+  }
+  return n;
+}
+
+//simple AI for a snake with its head at (x,y), occasionally turns left or right,
+//never reverses, and steers toward open space using short looks into the occupancy bitmap
+void steer(int x, int y, int* dx, int* dy, unsigned int* seed)
+{
+  int ahead, left, right;
+  int old_x = *dx;
+
+  ahead = free_run(x, y, *dx, *dy);
+  if (ahead == AGENT_LOOK && next_rand(seed) % AGENT_TURN != 0)
+  {
+    return;                   //open road, keep going
+  }
+  left = free_run(x, y, -*dy, old_x);
+  right = free_run(x, y, *dy, -old_x);
+  if (ahead == AGENT_LOOK)
+  {
+    //random turn, but only into open space
+    if (*seed & (AGENT_TURN << 1))
+    {
+      right = 0;
+    } else
+    {
+      left = 0;
+    }
+    if (left < AGENT_LOOK && right < AGENT_LOOK)
+    {
+      return;
+    }
+  }
+  if (left >= right && left > ahead)
+  {
+    *dx = -*dy;             //turn left
+    *dy = old_x;
+  } else if (right > ahead)
+  {
+    *dx = *dy;              //turn right
+    *dy = -old_x;
+  }
+}
+
+//headless driver for the player snake
+void agent_step()
+{
+  steer(curr_x, curr_y, &dir_x, &dir_y, &agent_seed);
+}
+
+void add_time(long long* total, long long* max, long long elapsed)
+{
+  *total += elapsed;
+  if (elapsed > *max)
+  {
+    *max = elapsed;
+  }
+}
+
+void print_stats()
+{
+  fprintf(stderr, "ticks %lld, avg tick %lld us, max tick %lld us\n", stats.ticks,
+          stats.ticks ? stats.tick_time / stats.ticks : 0, stats.max_tick);
+  fprintf(stderr, "frames %lld, avg render %lld us, max render %lld us\n", stats.frames,
+          stats.frames ? stats.render_time / stats.frames : 0, stats.max_render);
+  fprintf(stderr, "dropped %lld us of simulation time\n", stats.dropped);
+}
+
+//run the game logic flat out with no display, timing logic and rendering separately
+void run_headless(long long ticks, long long render_every, int scripted)
+{
+  char key;
+  int quit = 0;
+  long long i, start, logic_start, logic_time;
+  void* buf;
+
+  gfx_init_headless(gfx_default_context(), MAX_X + 1, MAX_Y + 1);
+  buf = new_offscreen_buffer();
+  if (!scripted)
+  {
+    dir_x = 1;              //agent starts heading right
+  }
+
+  logic_start = time_us();
+  for (i = 0; i < ticks && !quit; i++)
+  {
+    if (scripted)
+    {
+      while (!quit && poll_key(&key))
+      {
+        quit = handle_key(key);
+      }
+    } else
+    {
+      agent_step();
+    }
+    if ((dir_x != 0 || dir_y != 0) && move_snake(curr_x + dir_x, curr_y + dir_y))
+    {
+      stats.deaths++;
+      reset_snake();                //keep the load running
+    }
+    input_advance(TICK_US);
+    stats.ticks++;
+
+    if (render_every > 0 && stats.ticks % render_every == 0)
+    {
+      start = time_us();
+      draw_damage(buf);
+      blit_damage(buf);             //no frame buffer, just resets the damage list
+      stats.frames++;
+      add_time(&stats.render_time, &stats.max_render, time_us() - start);
+    }
+  }
+  logic_time = time_us() - logic_start - stats.render_time;
+
+  input_stop();
+  fprintf(stderr, "headless: %lld ticks in %lld us of logic, %.0f ticks/sec\n", stats.ticks, logic_time,
+          logic_time > 0 ? stats.ticks * 1e6 / logic_time : 0.0);
+  fprintf(stderr, "headless: %lld frames rendered, avg render %lld us, max render %lld us\n", stats.frames,
+          stats.frames ? stats.render_time / stats.frames : 0, stats.max_render);
+  fprintf(stderr, "headless: %lld deaths\n", stats.deaths);
+}
+
+//benchmark driver, sweeps the board row by row so a snake of any length never hits itself
+void sweep_step()
+{
+  static int sweep_dx = 1;          //horizontal direction of the current row
+
+  if (dir_y != 0)
+  {
+    dir_x = sweep_dx;               //stepped down a row, head back across
+    dir_y = 0;
+  } else if ((dir_x > 0 && curr_x == MAX_X) || (dir_x < 0 && curr_x == 0))
+  {
+    sweep_dx = -dir_x;              //end of row, step down
+    dir_x = 0;
+    dir_y = 1;
+  }
+}
+
+//tick cost for snakes of fixed length from 10 to 100,000 cells
+void run_benchmark()
+{
+  static const int lengths[] = { 10, 100, 1000, 10000, 100000 };
+  int l;
+  long long i, start, elapsed, deaths;
+
+  food_growth = 0;
+  for (l = 0; l < (int)(sizeof(lengths) / sizeof(lengths[0])); l++)
+  {
+    target_len = lengths[l];
+    reset_snake();
+    dir_x = 1;
+    dir_y = 0;
+    //grow to full length before measuring
+    while (body_len < target_len)
+    {
+      sweep_step();
+      move_snake(curr_x + dir_x, curr_y + dir_y);
+      num_damage = 0;
+    }
+
+    deaths = 0;
+    start = time_us();
+    for (i = 0; i < BENCH_TICKS; i++)
+    {
+      sweep_step();
+      deaths += move_snake(curr_x + dir_x, curr_y + dir_y);
+      num_damage = 0;
+    }
+    elapsed = time_us() - start;
+    printf("length %6d: %6.1f ns/tick, %lld collisions\n", target_len, elapsed * 1000.0 / BENCH_TICKS, deaths);
+  }
+}
+
+//one agent snake in world mode, body cells stored as grid indices
+struct world_agent
+{
+  int x;                          //head position and heading
+  int y;
+  int dx;
+  int dy;
+  unsigned int seed;              //per agent so steering does not depend on thread scheduling
+  unsigned int target;            //cell the head moves into this tick
+  int vacate;                     //1 if the tail cell is freed this tick
+  int head;
+  int len;
+  unsigned int body[WORLD_CAP];
+};
+
+//one pool thread, steps agents [lo, hi)
+struct world_worker
+{
+  int id;
+  int lo;
+  int hi;
+  pthread_t thread;
+  int* dead;                      //agents of this range that collided this tick, in index order
+  int num_dead;
+  long long deaths;
+};
+
+struct world_agent* agents;
+int num_agents;
+struct world_worker* workers;
+int num_workers;
+long long world_ticks;
+unsigned int claims[GRID_W * GRID_H];     //lowest agent id moving into each cell this tick
+pthread_barrier_t world_barrier;
+
+//bitmap updates that other threads may be making to the same word
+void set_blocked_atomic(unsigned int i)
+{
+  __sync_fetch_and_or(&blocked[i >> 5], 1u << (i & 31));
 }
 
-int main()
+void clear_blocked_atomic(unsigned int i)
+{
+  __sync_fetch_and_and(&blocked[i >> 5], ~(1u << (i & 31)));
+}
+
+//put agent a on a random free cell with a one cell body, serial only
+void world_spawn(struct world_agent* a)
+{
+  unsigned int i;
+
+  do
+  {
+    i = next_rand(&world_seed) % (GRID_W * GRID_H);
+  }
+  while (cell_blocked(i % GRID_W, i / GRID_W));
+  a->x = i % GRID_W;
+  a->y = i / GRID_W;
+  a->dx = 1;
+  a->dy = 0;
+  a->head = 0;
+  a->len = 1;
+  a->body[0] = i;
+  set_blocked(a->x, a->y);
+}
+
+//phase 1: pick a heading and target cell from last tick's board, reads the grid only
+void world_plan(struct world_worker* w)
+{
+  int i, nx, ny;
+
+  for (i = w->lo; i < w->hi; i++)
+  {
+    struct world_agent* a = &agents[i];
+    claims[a->target] = NO_CLAIM;         //last tick's claim, everyone is done reading it
+    steer(a->x, a->y, &a->dx, &a->dy, &a->seed);
+    nx = (a->x + a->dx + GRID_W) % GRID_W;
+    ny = (a->y + a->dy + GRID_H) % GRID_H;
+    a->target = ny * GRID_W + nx;
+    a->vacate = a->len >= WORLD_LEN;
+  }
+}
+
+//phase 2: free tail cells and bid for target cells, lowest agent id wins a contested cell
+void world_claim(struct world_worker* w)
+{
+  int i;
+  unsigned int old;
+
+  for (i = w->lo; i < w->hi; i++)
+  {
+    struct world_agent* a = &agents[i];
+    if (a->vacate)
+    {
+      clear_blocked_atomic(a->body[(a->head - (a->len - 1)) & (WORLD_CAP - 1)]);
+      a->len--;
+    }
+    do
+    {
+      old = claims[a->target];
+    }
+    while (old > (unsigned int)i && !__sync_bool_compare_and_swap(&claims[a->target], old, i));
+  }
+}
+
+//phase 3: winners move in, losers and anyone hitting a body or obstacle die
+void world_resolve(struct world_worker* w)
+{
+  int i;
+
+  w->num_dead = 0;
+  for (i = w->lo; i < w->hi; i++)
+  {
+    struct world_agent* a = &agents[i];
+    //only the claim holder can set this bit during this phase, so the read is stable
+    if (claims[a->target] != (unsigned int)i || cell_blocked(a->target % GRID_W, a->target / GRID_W))
+    {
+      w->dead[w->num_dead++] = i;
+      continue;
+    }
+    set_blocked_atomic(a->target);
+    a->head = (a->head + 1) & (WORLD_CAP - 1);
+    a->body[a->head] = a->target;
+    a->len++;
+    a->x = a->target % GRID_W;
+    a->y = a->target / GRID_W;
+  }
+}
+
+//phase 4, serial: clear and respawn dead agents in agent order so results never depend on thread count
+void world_respawn()
+{
+  int t, d, k;
+
+  for (t = 0; t < num_workers; t++)
+  {
+    for (d = 0; d < workers[t].num_dead; d++)
+    {
+      struct world_agent* a = &agents[workers[t].dead[d]];
+      for (k = 0; k < a->len; k++)
+      {
+        unsigned int c = a->body[(a->head - k) & (WORLD_CAP - 1)];
+        clear_blocked(c % GRID_W, c / GRID_W);
+      }
+      world_spawn(a);
+    }
+    workers[t].deaths += workers[t].num_dead;
+  }
+}
+
+void* world_thread(void* arg)
+{
+  struct world_worker* w = (struct world_worker*)arg;
+  long long t;
+
+  for (t = 0; t < world_ticks; t++)
+  {
+    world_plan(w);
+    pthread_barrier_wait(&world_barrier);
+    world_claim(w);
+    pthread_barrier_wait(&world_barrier);
+    world_resolve(w);
+    pthread_barrier_wait(&world_barrier);
+    if (w->id == 0)
+    {
+      world_respawn();
+    }
+    pthread_barrier_wait(&world_barrier);
+  }
+  return NULL;
+}
+
+//step many agent snakes on one board with a thread pool, report rate and a board checksum
+void run_world(int count, int threads, long long ticks)
+{
+  int i;
+  long long start, elapsed, deaths = 0;
+  unsigned int sum = 0;
+
+  num_agents = count;
+  num_workers = threads < count ? threads : count;
+  world_ticks = ticks;
+  agents = (struct world_agent*)calloc(num_agents, sizeof(struct world_agent));
+  workers = (struct world_worker*)calloc(num_workers, sizeof(struct world_worker));
+  memset(claims, 0xff, sizeof(claims));
+  memset(blocked, 0, sizeof(blocked));
+  for (i = 0; i < num_obstacles; i++)
+  {
+    set_blocked(obstacles[i].x, obstacles[i].y);
+  }
+  for (i = 0; i < num_agents; i++)
+  {
+    agents[i].seed = 2 * i + 1;
+    world_spawn(&agents[i]);
+  }
+
+  //contiguous ranges keep each thread's agents together and dead lists in agent order
+  for (i = 0; i < num_workers; i++)
+  {
+    workers[i].id = i;
+    workers[i].lo = (long long)num_agents * i / num_workers;
+    workers[i].hi = (long long)num_agents * (i + 1) / num_workers;
+    workers[i].dead = (int*)malloc((workers[i].hi - workers[i].lo) * sizeof(int));
+  }
+  pthread_barrier_init(&world_barrier, NULL, num_workers);
+
+  start = time_us();
+  for (i = 1; i < num_workers; i++)
+  {
+    pthread_create(&workers[i].thread, NULL, world_thread, &workers[i]);
+  }
+  world_thread(&workers[0]);        //main thread is worker 0
+  for (i = 1; i < num_workers; i++)
+  {
+    pthread_join(workers[i].thread, NULL);
+  }
+  elapsed = time_us() - start;
+
+  for (i = 0; i < num_workers; i++)
+  {
+    deaths += workers[i].deaths;
+    free(workers[i].dead);
+  }
+  for (i = 0; i < GRID_WORDS; i++)
+  {
+    sum = sum * 31 + blocked[i];    //same seed and agents give the same board for any -T
+  }
+  pthread_barrier_destroy(&world_barrier);
+  printf("world: %d agents, %d threads, %lld ticks in %lld us\n", num_agents, num_workers, ticks, elapsed);
+  printf("world: %.0f ticks/sec, %.0f agent moves/sec, %lld deaths, board checksum %08x\n",
+         elapsed > 0 ? ticks * 1e6 / elapsed : 0.0, elapsed > 0 ? ticks * 1e6 * num_agents / elapsed : 0.0,
+         deaths, sum);
+  free(workers);
+  free(agents);
+}
+
+int main(int argc, char** argv)
 {
-  int next_x = 0;         //where to move next based on arrow presses
-  int next_y = 0;
   char key;               //user input
-  char key2;              //for second char in ANSI sequence
+  int fast = 0;           //run frames back to back on a virtual clock when replaying at full speed
+  int scripted = 0;       //input comes from a replay file
+  int quit = 0;
+  int opt;
+  int err = 0;
+  long long headless = 0; //ticks to run headless, 0 for a normal game
+  long long render_every = 0;
+  long long prev, now, start;
+  long long acc = 0;      //real time not yet consumed by simulation ticks
+
+  int obstacle_count = 0;
+  int bench = 0;
+  int world = 0;          //agents in world mode, 0 for a single snake
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  while ((opt = getopt(argc, argv, "r:p:f:H:n:s:L:O:BW:T:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'r':
+        err = input_record(optarg);
+        break;
+      case 'p':
+        err = input_replay(optarg, INPUT_REPLAY_TIMED);
+        scripted = 1;
+        break;
+      case 'f':
+        err = input_replay(optarg, INPUT_REPLAY_FAST);
+        fast = 1;
+        scripted = 1;
+        break;
+      case 'H':
+        headless = atoll(optarg);
+        err = headless <= 0;
+        break;
+      case 'n':
+        render_every = atoll(optarg);
+        err = render_every < 0;
+        break;
+      case 's':
+        agent_seed = strtoul(optarg, NULL, 0);
+        err = agent_seed == 0;            //xorshift never leaves 0
+        break;
+      case 'L':
+        target_len = atoi(optarg);
+        err = target_len <= 0 || target_len >= SNAKE_CAP;
+        break;
+      case 'O':
+        obstacle_count = atoi(optarg);
+        err = obstacle_count < 0 || obstacle_count > MAX_OBSTACLES;
+        break;
+      case 'B':
+        bench = 1;
+        break;
+      case 'W':
+        world = atoi(optarg);
+        err = world <= 0;
+        break;
+      case 'T':
+        threads = atoi(optarg);
+        err = threads <= 0;
+        break;
+      default:
+        err = -1;
+        break;
+    }
+    if (err)
+    {
+      fprintf(stderr, "usage: snake [-r file | -p file | -f file] [-L len] [-O count] [-H ticks [-n N] [-s seed]] [-B] [-W agents [-T threads]]\n");
+      return 1;
+    }
+  }
+
+  //the benchmark sweep holds its length fixed and cannot steer round obstacles, it would
+  //hit the first one in its path on every tick and never reach the length it measures
+  if (bench && obstacle_count > 0)
+  {
+    fprintf(stderr, "snake: -B cannot be combined with -O\n");
+    return 1;
+  }
+
+  //room to list the damage from all the ticks one frame can cover, headless -n may run
+  //many more of them per frame than the interactive loop's catch-up limit allows
+  if (render_every > MAX_DAMAGE / DAMAGE_PER_TICK)
+  {
+    damage_cap = MAX_DAMAGE;
+  } else
+  {
+    damage_cap = DAMAGE_PER_TICK * (render_every > MAX_CATCHUP ? (int)render_every : MAX_CATCHUP);
+  }
+  damage = (struct cell*)malloc(damage_cap * sizeof(struct cell));
+  if (damage == NULL)
+  {
+    perror("snake");
+    return 1;
+  }
+
+  //first cell of the snake, then the board around it
+  reset_snake();
+  place_obstacles(obstacle_count);
+  place_food();
+
+  if (bench)
+  {
+    run_benchmark();
+    return 0;
+  }
+  if (world > 0)
+  {
+    run_world(world, threads > 0 ? threads : 1, headless > 0 ? headless : WORLD_TICKS);
+    return 0;
+  }
+  if (headless > 0)
+  {
+    run_headless(headless, render_every, scripted);
+    return 0;
+  }
 
   init_graphics();
 
   //new offscreen buffer to draw snake motion to
   void* buf = new_offscreen_buffer();
 
-  draw_pixel(buf, curr_x, curr_y, snake_color);     //draw initial snake at (0,0)
-  blit(buf);        //copy onto frame buffer
+  //full repaint once so the screen starts with just the board
+  damage_overflow = 1;
+  draw_damage(buf);
+  blit_damage(buf);        //copy onto frame buffer
 
-  do
+  prev = time_us();
+  while (!quit)
   {
-    //ANSI sequence
-    next_x = curr_x;
-    next_y = curr_y;          //reset location to current snake place
-    key = getkey();       //get keypress
-    key2 = getkey();      //get next keypress to check for ANSI arrow sequence
-    if (key == 27 && key2 == 91)        //these values indicate arrow key presses, ESC and [
+    //fast replay pretends each frame took exactly one display period
+    now = fast ? prev + FRAME_US : time_us();
+    acc += now - prev;
+    prev = now;
+    if (acc > MAX_CATCHUP * TICK_US)
+    {
+      stats.dropped += acc - MAX_CATCHUP * TICK_US;       //too far behind, keep tick rate stable
+      acc = MAX_CATCHUP * TICK_US;
+    }
+
+    //run as many fixed ticks as the elapsed time covers
+    while (acc >= TICK_US && !quit)
     {
-      key = getkey();           //must call again to read actual arrow key code
-      switch (key)
+      start = time_us();
+      while (!quit && poll_key(&key))
       {
-        case UP:
-          next_y--;
-          break;
-        case DOWN:
-          next_y++;
-          break;
-        case RIGHT:
-          next_x++;
-          break;
-        case LEFT:
-          next_x--;
-          break;
+        quit = handle_key(key);
       }
-      clear_screen(buf);                //clear screen
-      move_snake(buf, next_x, next_y);      //draw new offscreen snake movement
-      blit(buf);                        //copy offscreen to frame buffer
-    } else if (key == 'q')
+      //new head, vacated tail recorded as damage
+      if (!quit && (dir_x != 0 || dir_y != 0) && move_snake(curr_x + dir_x, curr_y + dir_y))
+      {
+        stats.deaths++;
+        quit = 1;                     //ran into something, game over
+      }
+      input_advance(TICK_US);
+      acc -= TICK_US;
+      stats.ticks++;
+      add_time(&stats.tick_time, &stats.max_tick, time_us() - start);
+    }
+
+    //cells are single pixels, so the interpolated head always rounds to a tick state
+    //and a frame just presents the damage from the ticks run since the last one
+    start = time_us();
+    draw_damage(buf);                 //draw new heads, erase old tails offscreen
+    blit_damage(buf);                 //copy only changed cells to frame buffer
+    stats.frames++;
+    add_time(&stats.render_time, &stats.max_render, time_us() - start);
+
+    if (!fast)
     {
-      break;          //user wishes to quit
+      long long left = prev + FRAME_US - time_us();
+      if (left > 0)
+      {
+        sleep_ms(left / 1000);        //wait for next display period
+      }
     }
-    sleep_ms(200);            //sleep between frames of graphics
   }
-  while (1);
 
   exit_graphics();        //unmap from memory, reset terminal settings
+  if (stats.deaths)
+  {
+    printf("Game over, length %d\n", body_len);
+  }
+  print_stats();
   return 0;
 }
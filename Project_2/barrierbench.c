@@ -0,0 +1,146 @@
+/*
+ *  CS 1550 Project 2: Producer/Consumer Problem
+ *  Scaling benchmark for phase synchronization between processes
+ *  Author: Michael Korst (mpk44@pitt.edu)
+ *
+ *  Usage: barrierbench [max_procs] [phases]
+ *  For 2, 4, ... max_procs processes (at most 64), every process runs the given number of
+ *  phases and waits for all the others at the end of each. Three ways of waiting are timed:
+ *  the cs1550 barrier syscall, a reusable barrier built from cs1550 semaphores (two
+ *  turnstiles and a mutex, several syscalls per process per phase), and an eventcount
+ *  that every process advances and then awaits.
+ */
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "cs1550.h"
+
+#define DEFAULT_PROCS 64
+#define DEFAULT_PHASES 10000
+#define MAX_PROCS 64
+
+#define USE_BARRIER 0
+#define USE_SEMAPHORES 1
+#define USE_EVENTCOUNT 2
+
+//everything the processes share, one MAP_SHARED page
+struct shared
+{
+  struct cs1550_barrier barrier;
+  struct cs1550_sem mutex;
+  struct cs1550_sem turnstile1;
+  struct cs1550_sem turnstile2;
+  int count;                          //arrivals, guarded by mutex
+  struct cs1550_eventcount ec;
+};
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void init_sem(struct cs1550_sem* sem, int value)
+{
+  sem->value = value;
+  sem->flags = 0;
+}
+
+//classic two turnstile barrier, the last one in opens the first turnstile for everyone,
+//the last one out of the second half opens the second so nobody laps the others
+static void sem_barrier(struct shared* sh, int procs)
+{
+  down(&sh->mutex);
+  if (++sh->count == procs)
+  {
+    up_n(&sh->turnstile1, procs);
+  }
+  up(&sh->mutex);
+  down(&sh->turnstile1);
+
+  down(&sh->mutex);
+  if (--sh->count == 0)
+  {
+    up_n(&sh->turnstile2, procs);
+  }
+  up(&sh->mutex);
+  down(&sh->turnstile2);
+}
+
+static void run_phases(struct shared* sh, int procs, int phases, int method)
+{
+  int i;
+  for (i = 1; i <= phases; i++)
+  {
+    if (method == USE_BARRIER)
+    {
+      cs1550_barrier_wait(&sh->barrier);
+    } else if (method == USE_SEMAPHORES)
+    {
+      sem_barrier(sh, procs);
+    } else
+    {
+      //phase i is over once everyone has advanced i times
+      cs1550_ec_advance(&sh->ec, 1);
+      cs1550_ec_await(&sh->ec, (unsigned int)i * procs);
+    }
+  }
+}
+
+//seconds for procs processes to get through all phases
+static double run_procs(struct shared* sh, int procs, int phases, int method)
+{
+  double start;
+  int i;
+
+  sh->barrier.parties = procs;
+  sh->barrier.arrived = 0;
+  sh->barrier.generation = 0;
+  init_sem(&sh->mutex, 1);
+  init_sem(&sh->turnstile1, 0);
+  init_sem(&sh->turnstile2, 0);
+  sh->count = 0;
+  sh->ec.count = 0;
+
+  start = now_sec();
+  for (i = 0; i < procs; i++)
+  {
+    if (fork() == 0)
+    {
+      run_phases(sh, procs, phases, method);
+      exit(0);
+    }
+  }
+  while (wait(NULL) > 0);
+  return now_sec() - start;
+}
+
+int main(int argc, char** argv)
+{
+  int max_procs = argc > 1 ? atoi(argv[1]) : DEFAULT_PROCS;
+  int phases = argc > 2 ? atoi(argv[2]) : DEFAULT_PHASES;
+  struct shared* sh = (struct shared*)mmap(NULL, sizeof(struct shared),
+  PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, 0, 0);
+  int procs;
+
+  if (max_procs > MAX_PROCS)
+  {
+    max_procs = MAX_PROCS;
+  }
+  printf("%-8s %-16s %-16s %-16s\n", "procs", "barrier ph/s", "semaphore ph/s", "eventcount ph/s");
+  for (procs = 2; procs <= max_procs; procs *= 2)
+  {
+    printf("%-8d %-16.0f %-16.0f %-16.0f\n", procs,
+           phases / run_procs(sh, procs, phases, USE_BARRIER),
+           phases / run_procs(sh, procs, phases, USE_SEMAPHORES),
+           phases / run_procs(sh, procs, phases, USE_EVENTCOUNT));
+  }
+  return 0;
+}
@@ -0,0 +1,369 @@
+/*
+ *  CS 1550 Project 2: Producer/Consumer Problem
+ *  User-space view of the cs1550 semaphore syscalls
+ *  Author: Michael Korst (mpk44@pitt.edu)
+ */
+
+#ifndef CS1550_H
+#define CS1550_H
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/unistd.h>
+#include <unistd.h>
+#include <time.h>
+
+//redefine semaphore struct for user programs, must match sys.c
+//the kernel knows a semaphore by the memory behind it, so in shared memory (mmap of a file
+//or MAP_SHARED|MAP_ANONYMOUS before fork, shm_open, shmget) it may sit at a different
+//address in each process, while in private memory each process has its own
+struct cs1550_sem
+{
+	int value;
+	int flags;								//CS1550_SEM_ options, set before first use
+};
+
+#define CS1550_SEM_PRIO 0x1        //wake waiters by nice value, FIFO among equal values
+//used as a mutex, holder inherits its best waiter's nice value, the kernel must see every
+//down and up to know who holds it, so the fast path below always enters it for these
+#define CS1550_SEM_PI 0x2
+
+//wrapper functions for semaphore system calls, always enter the kernel
+//down returns -1 with errno EINTR if a signal arrived before the resource did
+static inline int cs1550_down(struct cs1550_sem *sem)
+{
+  return syscall(__NR_cs1550_down, sem);
+}
+
+static inline void cs1550_up(struct cs1550_sem *sem)
+{
+  syscall(__NR_cs1550_up, sem);
+}
+
+//adds n and wakes up to n waiters, one syscall instead of n
+//returns -1 with errno EINVAL for n < 1, EOVERFLOW if the count would pass INT_MAX
+static inline int cs1550_up_n(struct cs1550_sem *sem, int n)
+{
+  return syscall(__NR_cs1550_up_n, sem, n);
+}
+
+//contention counters from cs1550_stats(), must match sys.c
+//only operations that enter the kernel are counted, the fast path below is invisible
+struct cs1550_stats
+{
+  unsigned long long acquisitions;    //units handed out by the kernel
+  unsigned long long blocked;         //downs that had to sleep
+  unsigned long long spun;            //downs satisfied by spinning, global only
+  unsigned long long aborted;         //sleeps cut short by a timeout or signal
+  unsigned long long ups;             //units released through the kernel
+  unsigned long long wait_ns;         //total time spent asleep
+  unsigned long long max_wait_ns;     //longest single sleep
+  long long depth;                    //tasks queued right now
+};
+
+//counters for sem, or totals across all semaphores if sem is NULL
+//returns -1 with errno ENOENT if the kernel is not tracking sem
+static inline int cs1550_stats(struct cs1550_sem *sem, struct cs1550_stats *stats)
+{
+  return syscall(__NR_cs1550_stats, sem, stats);
+}
+
+//one record read from /proc/cs1550_trace, must match sys.c
+//tracing is switched on by writing 1 to that file and off by writing 0, see semtrace.c
+struct cs1550_trace_event
+{
+  unsigned long long ns;              //CLOCK_MONOTONIC time of the event
+  unsigned long long sem;             //user address of the semaphore
+  unsigned long long arg;             //ns spun for CS1550_TRACE_LOCK, else 0
+  unsigned int pid;                   //task the event is about, the woken one for a wake
+  unsigned int type;
+};
+
+#define CS1550_TRACE_LOCK 0           //down or up spun a microsecond or more on the kernel lock
+#define CS1550_TRACE_ENQUEUE 1        //down went on the wait queue
+#define CS1550_TRACE_WAKE 2           //up handed pid a unit and woke it
+#define CS1550_TRACE_RESUME 3         //pid is running again
+#define CS1550_TRACE_ABORT 4          //pid gave up waiting on a timeout or signal
+
+//returns -1 with errno EAGAIN instead of sleeping if no resource is free
+static inline int cs1550_trydown(struct cs1550_sem *sem)
+{
+  return syscall(__NR_cs1550_trydown, sem);
+}
+
+//sleeps at most ns nanoseconds, returns -1 with errno ETIMEDOUT (or EINTR) if it gave up
+static inline int cs1550_down_timeout(struct cs1550_sem *sem, long long ns)
+{
+  struct timespec ts;
+  ts.tv_sec = ns / 1000000000;
+  ts.tv_nsec = ns % 1000000000;
+  return syscall(__NR_cs1550_down_timeout, sem, &ts);
+}
+
+//up up_sem and down down_sem in one syscall, queued on down_sem before the up can wake
+//anyone, the up has happened even when this returns -1 with errno EINTR
+//-1 with errno EOVERFLOW means up_sem was full and neither the up nor the down happened
+static inline int cs1550_up_down(struct cs1550_sem *up_sem, struct cs1550_sem *down_sem)
+{
+  return syscall(__NR_cs1550_up_down, up_sem, down_sem);
+}
+
+//one operation for cs1550_semop(), must match sys.c
+struct cs1550_sembuf
+{
+  struct cs1550_sem* sem;
+  int delta;                 //-1 to down, positive to up by that much
+};
+
+//apply all ops as one step in a single syscall, blocking until every down can proceed
+//a signal just restarts the wait, returns 0 once applied or -1 with errno EINVAL for a bad
+//nops or delta, EFAULT, or EOVERFLOW if an up would pass INT_MAX, having applied none
+static inline int cs1550_semop(struct cs1550_sembuf* ops, int nops)
+{
+  int ret;
+
+  while ((ret = syscall(__NR_cs1550_semop, ops, nops)) == -1 && errno == EINTR);
+  return ret;
+}
+
+//kernel-managed semaphores: the count and the wait queue stay in the kernel and user space
+//only holds the handle, usable by any process of the creator's user that knows it, others
+//get EACCES; handles outlive their process, so destroy them when done
+//create returns the handle, or -1 with errno ENOSPC when the kernel table is full or the
+//user already holds 256
+static inline int cs1550_create(int value)
+{
+  return syscall(__NR_cs1550_create, value);
+}
+
+//fails with errno EBUSY while tasks are asleep on the semaphore
+static inline int cs1550_destroy(int handle)
+{
+  return syscall(__NR_cs1550_destroy, handle);
+}
+
+//returns -1 with errno EINTR if a signal arrived first, EINVAL for a destroyed handle
+static inline int cs1550_down_handle(int handle)
+{
+  return syscall(__NR_cs1550_down_handle, handle);
+}
+
+static inline int cs1550_up_handle(int handle)
+{
+  return syscall(__NR_cs1550_up_handle, handle);
+}
+
+//fd for a handle that poll/select/epoll report readable while a down would not sleep,
+//read() of an int does the down and stores 1, with O_NONBLOCK it fails with EAGAIN
+//instead of sleeping, the handle cannot be destroyed until every such fd is closed
+static inline int cs1550_sem_fd(int handle)
+{
+  return syscall(__NR_cs1550_sem_fd, handle);
+}
+
+//reader-writer semaphore, zero it before first use, must match sys.c
+//a reader arriving while a writer is queued waits behind it, so writers are not starved
+struct cs1550_rwsem
+{
+  int active;                //readers inside, or -1 while a writer is
+  int waiting;               //tasks queued
+};
+
+//downs return -1 with errno EINTR if a signal arrived first, every call EFAULT if rw is not
+//writable memory
+static inline int cs1550_down_read(struct cs1550_rwsem *rw)
+{
+  return syscall(__NR_cs1550_down_read, rw);
+}
+
+static inline int cs1550_up_read(struct cs1550_rwsem *rw)
+{
+  return syscall(__NR_cs1550_up_read, rw);
+}
+
+static inline int cs1550_down_write(struct cs1550_rwsem *rw)
+{
+  return syscall(__NR_cs1550_down_write, rw);
+}
+
+static inline int cs1550_up_write(struct cs1550_rwsem *rw)
+{
+  return syscall(__NR_cs1550_up_write, rw);
+}
+
+//N-party barrier, set parties and zero the rest before first use, must match sys.c
+struct cs1550_barrier
+{
+  int parties;
+  int arrived;
+  unsigned int generation;
+};
+
+//returns 1 in the one process that opened the barrier, 0 in the rest
+static inline int cs1550_barrier_wait(struct cs1550_barrier *b)
+{
+  int ret;
+  while ((ret = syscall(__NR_cs1550_barrier_wait, b)) == -1 && errno == EINTR);
+  return ret;
+}
+
+//eventcount and sequencer, zero both before first use
+struct cs1550_eventcount
+{
+  unsigned int count;        //read it directly, only the kernel writes it
+};
+
+struct cs1550_sequencer
+{
+  unsigned int next;
+};
+
+//sleep until the eventcount reaches value
+static inline void cs1550_ec_await(struct cs1550_eventcount *ec, unsigned int value)
+{
+  //nothing to wait for, skip the kernel
+  if ((int)(*(volatile unsigned int*)&ec->count - value) >= 0)
+  {
+    return;
+  }
+  while (syscall(__NR_cs1550_ec_await, ec, value) == -1 && errno == EINTR);
+}
+
+//move the eventcount forward by n, waking everyone it reached, returns 0 or -1 with errno
+//EFAULT, read ec->count for the new count
+static inline int cs1550_ec_advance(struct cs1550_eventcount *ec, unsigned int n)
+{
+  return syscall(__NR_cs1550_ec_advance, ec, n);
+}
+
+//next ticket in line, never enters the kernel
+static inline unsigned int cs1550_ticket(struct cs1550_sequencer *seq)
+{
+  return __sync_fetch_and_add(&seq->next, 1);
+}
+
+//futex-style fast path: update value with compare-and-swap while nobody has to sleep
+//or be woken, and fall back to the syscall otherwise. The kernel updates value
+//atomically too, so both sides agree on the count without sharing a lock.
+//take a free resource without the kernel, returns 0 if none was free or the kernel has
+//to hand it out itself
+static inline int fast_take(struct cs1550_sem *sem)
+{
+  int v = *(volatile int*)&sem->value;
+
+  if (sem->flags & CS1550_SEM_PI)
+  {
+    return 0;
+  }
+  while (v > 0)
+  {
+    int seen = __sync_val_compare_and_swap(&sem->value, v, v - 1);
+    if (seen == v)
+    {
+      return 1;
+    }
+    v = seen;
+  }
+  return 0;
+}
+
+static inline void down(struct cs1550_sem *sem)
+{
+  if (fast_take(sem))
+  {
+    return;
+  }
+  //must sleep, kernel decrements and queues us, retry if a handled signal cut the wait short
+  while (cs1550_down(sem) == -1 && errno == EINTR);
+}
+
+//never enters the kernel, a unit is either free in value or it is not, except for
+//CS1550_SEM_PI semaphores whose holder the kernel records
+static inline int trydown(struct cs1550_sem *sem)
+{
+  if (sem->flags & CS1550_SEM_PI)
+  {
+    return cs1550_trydown(sem);
+  }
+  if (fast_take(sem))
+  {
+    return 0;
+  }
+  errno = EAGAIN;
+  return -1;
+}
+
+//returns 0 with the resource or -1 with errno ETIMEDOUT once ns nanoseconds pass without one
+static inline int down_timeout(struct cs1550_sem *sem, long long ns)
+{
+  if (fast_take(sem))
+  {
+    return 0;
+  }
+  return cs1550_down_timeout(sem, ns);
+}
+
+static inline void up(struct cs1550_sem *sem)
+{
+  int v = *(volatile int*)&sem->value;
+
+  //nobody is waiting (value would be negative), just release, unless the kernel has to
+  //see the holder let go
+  while (v >= 0 && !(sem->flags & CS1550_SEM_PI))
+  {
+    int seen = __sync_val_compare_and_swap(&sem->value, v, v + 1);
+    if (seen == v)
+    {
+      return;
+    }
+    v = seen;
+  }
+  cs1550_up(sem);            //waiters queued, kernel increments and wakes one
+}
+
+//release one semaphore and wait on another, like a condition variable wait without a lost
+//wakeup window, a signal after the up just leaves the down to finish on its own
+//returns 0 holding down_sem, or -1 with errno from cs1550_up_down() having done neither
+static inline int up_down(struct cs1550_sem *up_sem, struct cs1550_sem *down_sem)
+{
+  if (cs1550_up_down(up_sem, down_sem) == -1)
+  {
+    if (errno != EINTR)
+    {
+      return -1;
+    }
+    down(down_sem);
+  }
+  return 0;
+}
+
+//fails like cs1550_up_n(), without entering the kernel when nobody waits
+static inline int up_n(struct cs1550_sem *sem, int n)
+{
+  int v = *(volatile int*)&sem->value;
+
+  if (n < 1)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  while (v >= 0 && !(sem->flags & CS1550_SEM_PI))
+  {
+    int seen;
+
+    if (v > INT_MAX - n)
+    {
+      errno = EOVERFLOW;
+      return -1;
+    }
+    seen = __sync_val_compare_and_swap(&sem->value, v, v + n);
+    if (seen == v)
+    {
+      return 0;
+    }
+    v = seen;
+  }
+  return cs1550_up_n(sem, n);  //waiters queued, kernel hands them units first
+}
+
+#endif
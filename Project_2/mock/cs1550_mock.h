@@ -0,0 +1,102 @@
+/*
+ *  CS 1550 Project 2: Producer/Consumer Problem
+ *  Entry points of the mock kernel build of the cs1550 semaphore code
+ *  Author: Michael Korst (mpk44@pitt.edu)
+ */
+
+#ifndef CS1550_MOCK_H
+#define CS1550_MOCK_H
+
+#include <poll.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+//must match sys.c
+struct cs1550_sem
+{
+  int value;
+  int flags;
+};
+
+#define CS1550_SEM_PRIO 0x1
+#define CS1550_SEM_PI 0x2
+
+struct cs1550_rwsem
+{
+  int active;
+  int waiting;
+};
+
+struct cs1550_barrier
+{
+  int parties;
+  int arrived;
+  unsigned int generation;
+};
+
+struct cs1550_eventcount
+{
+  unsigned int count;
+};
+
+struct cs1550_sembuf
+{
+  struct cs1550_sem* sem;
+  int delta;
+};
+
+struct cs1550_stats
+{
+  unsigned long long acquisitions;
+  unsigned long long blocked;
+  unsigned long long spun;
+  unsigned long long aborted;
+  unsigned long long ups;
+  unsigned long long wait_ns;
+  unsigned long long max_wait_ns;
+  long long depth;
+};
+
+//the syscalls, compiled unchanged from sys.c
+long sys_cs1550_down(struct cs1550_sem* sem);
+long sys_cs1550_up(struct cs1550_sem* sem);
+long sys_cs1550_semop(struct cs1550_sembuf* ops, int nops);
+long sys_cs1550_trydown(struct cs1550_sem* sem);
+long sys_cs1550_down_timeout(struct cs1550_sem* sem, struct timespec* timeout);
+long sys_cs1550_up_n(struct cs1550_sem* sem, int n);
+long sys_cs1550_up_down(struct cs1550_sem* up_sem, struct cs1550_sem* down_sem);
+long sys_cs1550_stats(struct cs1550_sem* sem, struct cs1550_stats* stats);
+long sys_cs1550_create(int value);
+long sys_cs1550_destroy(int handle);
+long sys_cs1550_down_handle(int handle);
+long sys_cs1550_up_handle(int handle);
+long sys_cs1550_sem_fd(int handle);
+long sys_cs1550_down_read(struct cs1550_rwsem* rw);
+long sys_cs1550_up_read(struct cs1550_rwsem* rw);
+long sys_cs1550_down_write(struct cs1550_rwsem* rw);
+long sys_cs1550_up_write(struct cs1550_rwsem* rw);
+long sys_cs1550_barrier_wait(struct cs1550_barrier* b);
+long sys_cs1550_ec_await(struct cs1550_eventcount* ec, unsigned int value);
+long sys_cs1550_ec_advance(struct cs1550_eventcount* ec, unsigned int n);
+
+//harness control, see kshim.c
+pid_t kshim_task_start(void);
+void kshim_signal(pid_t pid);
+void kshim_clear_signal(pid_t pid);
+unsigned long kshim_parks(pid_t pid);
+void kshim_set_nice(pid_t pid, int nice);
+void kshim_set_euid(pid_t pid, uid_t euid);
+void kshim_set_fault_every(int n);
+void kshim_map_shared(void* start, size_t len, void* inode, unsigned long pgoff);
+int kshim_boot_option(const char* option);
+int kshim_proc_show(const char* name, FILE* out);
+ssize_t kshim_proc_read(const char* name, void* buf, size_t count);
+ssize_t kshim_proc_write(const char* name, const void* buf, size_t count);
+
+//descriptors from sys_cs1550_sem_fd(), these stand in for read(), poll(), fcntl() and close()
+ssize_t kshim_read(int fd, void* buf, size_t count);
+int kshim_poll(struct pollfd* fds, int nfds, int timeout);
+void kshim_set_nonblock(int fd, int nonblock);
+int kshim_close(int fd);
+
+#endif
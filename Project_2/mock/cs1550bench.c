@@ -0,0 +1,824 @@
+/*
+ *  CS 1550 Project 2: Producer/Consumer Problem
+ *  Multi-threaded stress and latency benchmark for the mock kernel build
+ *  Author: Michael Korst (mpk44@pitt.edu)
+ *
+ *  Usage: cs1550bench [-t threads] [-n iterations] [-w work] [-k boot_option]... [-p] [-T trace_file]
+ *  mutex:    threads take turns on one semaphore guarding a counter, the counter is
+ *            checked at the end, down latency percentiles and parks per down reported
+ *  pingpong: pairs of threads bounce a unit between two semaphores, round trip latency
+ *  updown:   pingpong with each side's up and down merged into one sys_cs1550_up_down()
+ *  aborts:   thread 0 hands out units and signals the others, which take them with every
+ *            kind of down, so waiters give up while queued and while being woken
+ *  alias:    the mutex test with odd threads reaching the semaphore through a second
+ *            mapping of its page, as processes sharing memory at different addresses do
+ *  handles:  the mutex test on a kernel-managed semaphore
+ *  pollfd:   thread 0 serves every other thread through one poll over semaphore fds, each
+ *            client ups its request semaphore and waits for an up on its own reply one,
+ *            round trip latency
+ *  fifo-hi, prio-hi, pi-hi: the mutex test with one thread at nice 0 and the rest at
+ *            nice 10, plain FIFO, CS1550_SEM_PRIO, and with CS1550_SEM_PI added,
+ *            latency is reported for the nice 0 thread only
+ *  rw-mutex, rwsem: one write per 10 operations, the rest read, -w work inside each,
+ *            through a mutex and then through a reader-writer semaphore
+ *  barrier:  all threads meet at a cs1550 barrier every iteration
+ *  -w spins that many loop iterations inside the critical section, -k passes a boot
+ *  option such as cs1550_spin=0 to the kernel code, -p prints /proc/cs1550_sem at the end,
+ *  -T turns on tracing and saves the events to a file that semtrace -f can read.
+ */
+
+#define _GNU_SOURCE                 //memfd_create()
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cs1550_mock.h"
+
+#define MAX_THREADS 64
+#define BATCH_NICE 10              //nice value of the background threads in the priority tests
+#define RW_WRITE_EVERY 10          //one write per this many operations in the read-heavy tests
+#define HANDLE_LIMIT 1024           //size of the kernel's handle table
+#define ABORT_TIMEOUT_NS 20000      //down_timeout in the abort test, short enough to expire often
+#define FAULT_EVERY 16              //injected page fault rate in the -flt tests
+
+struct worker
+{
+  pthread_t thread;
+  int id;
+  unsigned long long* samples;      //ns per timed operation
+  int timed;                        //samples count toward the reported latency
+  int nice;                         //nice value the kernel code sees for this thread
+  unsigned long parks;              //times this thread slept in schedule()
+};
+
+static int nthreads = 4;
+static int iters = 100000;
+static int work = 50;
+
+static struct cs1550_sem mutex;
+static struct cs1550_rwsem rwsem;
+static struct cs1550_barrier barrier;
+static struct cs1550_eventcount eventcount;
+static struct cs1550_sem pair_sems[MAX_THREADS];
+static struct cs1550_sem* alias_sems[2];     //one semaphore through two mappings
+static int alias_inode;                     //stands in for the file behind both mappings
+static int mutex_handle;
+static int request_handles[MAX_THREADS];
+static int reply_handles[MAX_THREADS];
+static int request_fds[MAX_THREADS];
+static int user_handles[HANDLE_LIMIT];
+static struct cs1550_sem abort_sem;         //units come only from the abort test's controller
+static struct cs1550_sem abort_done;        //upped by every semop that got abort_sem
+static pid_t abort_pids[MAX_THREADS];
+static volatile int abort_running;          //workers still going, the controller feeds them
+static long abort_got, abort_semops, abort_released, abort_interrupted, abort_timed_out;
+static volatile long counter;
+static pthread_barrier_t start_line;
+static FILE* trace_out;
+static volatile int trace_done;
+
+static unsigned long long now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void init_sem(struct cs1550_sem* sem, int value)
+{
+  sem->value = value;
+  sem->flags = 0;
+}
+
+static void critical_section()
+{
+  volatile int i;
+  counter++;
+  for (i = 0; i < work; i++);
+}
+
+static void* mutex_worker(void* arg)
+{
+  struct worker* w = (struct worker*)arg;
+  pid_t pid = kshim_task_start();
+  int i;
+
+  kshim_set_nice(pid, w->nice);
+
+  pthread_barrier_wait(&start_line);
+  for (i = 0; i < iters; i++)
+  {
+    unsigned long long t = now_ns();
+    sys_cs1550_down(&mutex);
+    w->samples[i] = now_ns() - t;
+    critical_section();
+    sys_cs1550_up(&mutex);
+  }
+  w->parks = kshim_parks(pid);
+  return NULL;
+}
+
+static void* alias_worker(void* arg)
+{
+  struct worker* w = (struct worker*)arg;
+  pid_t pid = kshim_task_start();
+  struct cs1550_sem* sem = alias_sems[w->id % 2];
+  int i;
+
+  pthread_barrier_wait(&start_line);
+  for (i = 0; i < iters; i++)
+  {
+    unsigned long long t = now_ns();
+    sys_cs1550_down(sem);
+    w->samples[i] = now_ns() - t;
+    critical_section();
+    sys_cs1550_up(sem);
+  }
+  w->parks = kshim_parks(pid);
+  return NULL;
+}
+
+//map the same page twice, shared, and tell the kernel code both are the same file
+static int map_alias()
+{
+  int fd = memfd_create("cs1550bench", 0);
+  int i;
+
+  if (fd < 0 || ftruncate(fd, 4096) != 0)
+  {
+    perror("memfd_create");
+    return -1;
+  }
+  for (i = 0; i < 2; i++)
+  {
+    alias_sems[i] = (struct cs1550_sem*)mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (alias_sems[i] == MAP_FAILED)
+    {
+      perror("mmap");
+      return -1;
+    }
+    kshim_map_shared(alias_sems[i], 4096, &alias_inode, 0);
+  }
+  close(fd);
+  return 0;
+}
+
+static void* handle_worker(void* arg)
+{
+  struct worker* w = (struct worker*)arg;
+  pid_t pid = kshim_task_start();
+  int i;
+
+  pthread_barrier_wait(&start_line);
+  for (i = 0; i < iters; i++)
+  {
+    unsigned long long t = now_ns();
+    sys_cs1550_down_handle(mutex_handle);
+    w->samples[i] = now_ns() - t;
+    critical_section();
+    sys_cs1550_up_handle(mutex_handle);
+  }
+  w->parks = kshim_parks(pid);
+  return NULL;
+}
+
+//thread 0 waits on every request fd at once and answers each request it reads
+static void* pollfd_worker(void* arg)
+{
+  struct worker* w = (struct worker*)arg;
+  pid_t pid = kshim_task_start();
+  int i;
+
+  pthread_barrier_wait(&start_line);
+  if (w->id == 0)
+  {
+    struct pollfd fds[MAX_THREADS];
+    long served = 0;
+    int unit;
+
+    for (i = 1; i < nthreads; i++)
+    {
+      fds[i - 1].fd = request_fds[i];
+      fds[i - 1].events = POLLIN;
+    }
+    while (served < (long)(nthreads - 1) * iters)
+    {
+      kshim_poll(fds, nthreads - 1, -1);
+      for (i = 1; i < nthreads; i++)
+      {
+        if ((fds[i - 1].revents & POLLIN) && kshim_read(request_fds[i], &unit, sizeof(unit)) == sizeof(unit))
+        {
+          sys_cs1550_up_handle(reply_handles[i]);
+          served++;
+        }
+      }
+    }
+  } else
+  {
+    for (i = 0; i < iters; i++)
+    {
+      unsigned long long t = now_ns();
+      sys_cs1550_up_handle(request_handles[w->id]);
+      sys_cs1550_down_handle(reply_handles[w->id]);
+      w->samples[i] = now_ns() - t;
+    }
+  }
+  w->parks = kshim_parks(pid);
+  return NULL;
+}
+
+//every RW_WRITE_EVERY-th operation writes, the rest read, all through the one mutex
+static void* rw_mutex_worker(void* arg)
+{
+  struct worker* w = (struct worker*)arg;
+  pid_t pid = kshim_task_start();
+  volatile int j;
+  int i;
+
+  pthread_barrier_wait(&start_line);
+  for (i = 0; i < iters; i++)
+  {
+    unsigned long long t = now_ns();
+    sys_cs1550_down(&mutex);
+    w->samples[i] = now_ns() - t;
+    if (i % RW_WRITE_EVERY == 0)
+    {
+      counter++;
+    }
+    for (j = 0; j < work; j++);
+    sys_cs1550_up(&mutex);
+  }
+  w->parks = kshim_parks(pid);
+  return NULL;
+}
+
+//same mix, readers share the rwsem
+static void* rwsem_worker(void* arg)
+{
+  struct worker* w = (struct worker*)arg;
+  pid_t pid = kshim_task_start();
+  volatile int j;
+  int i;
+
+  pthread_barrier_wait(&start_line);
+  for (i = 0; i < iters; i++)
+  {
+    unsigned long long t = now_ns();
+    if (i % RW_WRITE_EVERY == 0)
+    {
+      sys_cs1550_down_write(&rwsem);
+      w->samples[i] = now_ns() - t;
+      counter++;
+      for (j = 0; j < work; j++);
+      sys_cs1550_up_write(&rwsem);
+    } else
+    {
+      sys_cs1550_down_read(&rwsem);
+      w->samples[i] = now_ns() - t;
+      for (j = 0; j < work; j++);
+      sys_cs1550_up_read(&rwsem);
+    }
+  }
+  w->parks = kshim_parks(pid);
+  return NULL;
+}
+
+//every thread meets at the barrier once per iteration, latency is the whole wait
+static void* barrier_worker(void* arg)
+{
+  struct worker* w = (struct worker*)arg;
+  pid_t pid = kshim_task_start();
+  int i;
+
+  pthread_barrier_wait(&start_line);
+  for (i = 0; i < iters; i++)
+  {
+    unsigned long long t = now_ns();
+    if (sys_cs1550_barrier_wait(&barrier) == 1)
+    {
+      counter++;                    //exactly one opener per generation
+    }
+    w->samples[i] = now_ns() - t;
+  }
+  w->parks = kshim_parks(pid);
+  return NULL;
+}
+
+//even ids ping, odd ids pong, each pair owns two semaphores
+static void* pingpong_worker(void* arg)
+{
+  struct worker* w = (struct worker*)arg;
+  pid_t pid = kshim_task_start();
+  struct cs1550_sem* a = &pair_sems[w->id & ~1];
+  struct cs1550_sem* b = a + 1;
+  int i;
+
+  pthread_barrier_wait(&start_line);
+  for (i = 0; i < iters; i++)
+  {
+    if (w->id % 2 == 0)
+    {
+      unsigned long long t = now_ns();
+      sys_cs1550_up(a);
+      sys_cs1550_down(b);
+      w->samples[i] = now_ns() - t;
+    } else
+    {
+      sys_cs1550_down(a);
+      sys_cs1550_up(b);
+    }
+  }
+  w->parks = kshim_parks(pid);
+  return NULL;
+}
+
+//pingpong with each side's up and down done by one sys_cs1550_up_down()
+static void* updown_worker(void* arg)
+{
+  struct worker* w = (struct worker*)arg;
+  pid_t pid = kshim_task_start();
+  struct cs1550_sem* a = &pair_sems[w->id & ~1];
+  struct cs1550_sem* b = a + 1;
+  int i;
+
+  pthread_barrier_wait(&start_line);
+  if (w->id % 2 == 0)
+  {
+    for (i = 0; i < iters; i++)
+    {
+      unsigned long long t = now_ns();
+      sys_cs1550_up_down(a, b);
+      w->samples[i] = now_ns() - t;
+    }
+  } else
+  {
+    sys_cs1550_down(a);
+    for (i = 1; i < iters; i++)
+    {
+      sys_cs1550_up_down(b, a);
+    }
+    sys_cs1550_up(b);
+  }
+  w->parks = kshim_parks(pid);
+  return NULL;
+}
+
+//worker 0 hands out units with up_n and signals the others at random while they take units
+//with every kind of down, so waiters give up on signals and timeouts while queued and
+//while being woken; the counts must still add up when everyone is done
+static void* abort_worker(void* arg)
+{
+  struct worker* w = (struct worker*)arg;
+  pid_t pid = kshim_task_start();
+  struct timespec timeout = { 0, ABORT_TIMEOUT_NS };
+  struct cs1550_sembuf ops[2] = { { &abort_done, 1 }, { &abort_sem, -1 } };
+  struct timespec pause = { 0, 5000 };
+  unsigned int seed = (unsigned int)pid;
+  long ret = 0;
+  int i;
+
+  abort_pids[w->id] = pid;
+  pthread_barrier_wait(&start_line);
+  if (w->id == 0)
+  {
+    while (abort_running > 0)
+    {
+      int n = 1 + rand_r(&seed) % 3;
+
+      kshim_signal(abort_pids[1 + rand_r(&seed) % (nthreads - 1)]);
+      sys_cs1550_up_n(&abort_sem, n);
+      __sync_fetch_and_add(&abort_released, n);
+      nanosleep(&pause, NULL);
+    }
+  } else
+  {
+    for (i = 0; i < iters; i++)
+    {
+      unsigned long long t = now_ns();
+      switch (i % 4)
+      {
+        case 0:
+          ret = sys_cs1550_down(&abort_sem);
+          break;
+        case 1:
+          ret = sys_cs1550_down_timeout(&abort_sem, &timeout);
+          break;
+        case 2:
+          ret = sys_cs1550_trydown(&abort_sem);
+          break;
+        case 3:
+          ret = sys_cs1550_semop(ops, 2);
+          break;
+      }
+      w->samples[i] = now_ns() - t;
+      if (ret == 0)
+      {
+        __sync_fetch_and_add(&abort_got, 1);
+        if (i % 4 == 3)
+        {
+          __sync_fetch_and_add(&abort_semops, 1);
+        }
+      } else if (ret == -EINTR)
+      {
+        __sync_fetch_and_add(&abort_interrupted, 1);
+        kshim_clear_signal(pid);    //handled, as a real handler would have run
+      } else if (ret == -ETIMEDOUT)
+      {
+        __sync_fetch_and_add(&abort_timed_out, 1);
+      }
+    }
+    __sync_fetch_and_sub(&abort_running, 1);
+  }
+  w->parks = kshim_parks(pid);
+  return NULL;
+}
+
+//save trace events every millisecond until the tests are over, the per-CPU rings are
+//small and would overwrite events if left alone for long
+static void* trace_drainer(void* arg)
+{
+  char buf[4096];
+  struct timespec ms = { 0, 1000000 };
+  ssize_t n;
+  int done;
+
+  do
+  {
+    done = trace_done;
+    while ((n = kshim_proc_read("cs1550_trace", buf, sizeof(buf))) > 0)
+    {
+      fwrite(buf, 1, n, trace_out);
+    }
+    nanosleep(&ms, NULL);
+  } while (!done);
+  return NULL;
+}
+
+static int cmp_ull(const void* a, const void* b)
+{
+  unsigned long long x = *(const unsigned long long*)a;
+  unsigned long long y = *(const unsigned long long*)b;
+  return x < y ? -1 : x > y;
+}
+
+//run fn on every worker, then print throughput, latency percentiles and parks per operation
+//over the workers marked timed
+static void run(const char* name, void* (*fn)(void*), struct worker* workers)
+{
+  unsigned long long start, elapsed;
+  unsigned long long* all;
+  unsigned long parks = 0;
+  size_t n;
+  int i, s = 0;
+
+  pthread_barrier_init(&start_line, NULL, nthreads + 1);
+  for (i = 0; i < nthreads; i++)
+  {
+    memset(workers[i].samples, 0, sizeof(unsigned long long) * iters);
+    pthread_create(&workers[i].thread, NULL, fn, &workers[i]);
+  }
+  //workers may run to completion before we get the CPU back from the barrier
+  start = now_ns();
+  pthread_barrier_wait(&start_line);
+  for (i = 0; i < nthreads; i++)
+  {
+    pthread_join(workers[i].thread, NULL);
+    parks += workers[i].parks;
+  }
+  elapsed = now_ns() - start;
+  pthread_barrier_destroy(&start_line);
+
+  for (i = 0; i < nthreads; i++)
+  {
+    s += workers[i].timed;
+  }
+  n = (size_t)s * iters;
+  s = 0;
+  all = (unsigned long long*)malloc(sizeof(unsigned long long) * n);
+  for (i = 0; i < nthreads; i++)
+  {
+    if (!workers[i].timed)
+    {
+      continue;
+    }
+    memcpy(all + (size_t)s * iters, workers[i].samples, sizeof(unsigned long long) * iters);
+    s++;
+  }
+  qsort(all, n, sizeof(unsigned long long), cmp_ull);
+  printf("%-10s %12.0f %10llu %10llu %10llu %10.3f\n", name, (double)nthreads * iters / (elapsed / 1e9),
+         all[n / 2], all[n * 99 / 100], all[n - 1], (double)parks / ((double)nthreads * iters));
+  free(all);
+}
+
+//time every stride-th worker, the others run at batch_nice while the timed ones stay at 0
+static void set_roles(struct worker* workers, int stride, int batch_nice)
+{
+  int i;
+  for (i = 0; i < nthreads; i++)
+  {
+    workers[i].timed = i % stride == 0;
+    workers[i].nice = workers[i].timed ? 0 : batch_nice;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  struct worker workers[MAX_THREADS];
+  pthread_t drainer;
+  const char* trace_path = NULL;
+  int print_proc = 0;
+  int opt, i;
+  int held = 0;
+  struct cs1550_stats stats;
+  pid_t main_pid;
+
+  while ((opt = getopt(argc, argv, "t:n:w:k:pT:")) != -1)
+  {
+    switch (opt)
+    {
+      case 't':
+        nthreads = atoi(optarg);
+        break;
+      case 'n':
+        iters = atoi(optarg);
+        break;
+      case 'w':
+        work = atoi(optarg);
+        break;
+      case 'k':
+        if (!kshim_boot_option(optarg))
+        {
+          fprintf(stderr, "unknown boot option %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'p':
+        print_proc = 1;
+        break;
+      case 'T':
+        trace_path = optarg;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-t threads] [-n iterations] [-w work] [-k boot_option]... [-p] [-T trace_file]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (nthreads < 2 || nthreads > MAX_THREADS || iters < 1)
+  {
+    fprintf(stderr, "need 2 to %d threads and at least one iteration\n", MAX_THREADS);
+    return 1;
+  }
+  nthreads &= ~1;                   //pingpong needs whole pairs
+  for (i = 0; i < nthreads; i++)
+  {
+    workers[i].id = i;
+    workers[i].samples = (unsigned long long*)malloc(sizeof(unsigned long long) * iters);
+  }
+  main_pid = kshim_task_start();    //main thread calls into the kernel code too
+  if (trace_path != NULL)
+  {
+    trace_out = fopen(trace_path, "wb");
+    if (trace_out == NULL)
+    {
+      perror(trace_path);
+      return 1;
+    }
+    kshim_proc_write("cs1550_trace", "1", 1);
+    pthread_create(&drainer, NULL, trace_drainer, NULL);
+  }
+
+  printf("%d threads, %d iterations each, %d work\n", nthreads, iters, work);
+  printf("%-10s %12s %10s %10s %10s %10s\n", "test", "ops/s", "p50 ns", "p99 ns", "max ns", "parks/op");
+
+  set_roles(workers, 1, 0);
+  init_sem(&mutex, 1);
+  counter = 0;
+  run("mutex", mutex_worker, workers);
+  if (counter != (long)nthreads * iters)
+  {
+    fprintf(stderr, "mutex: counter is %ld, expected %ld\n", counter, (long)nthreads * iters);
+    return 1;
+  }
+  if (sys_cs1550_up_n(&mutex, INT_MAX) != -EOVERFLOW || sys_cs1550_up_n(&mutex, 0) != -EINVAL ||
+      mutex.value != 1)
+  {
+    fprintf(stderr, "mutex: up_n past INT_MAX or by 0 changed the count to %d\n", mutex.value);
+    return 1;
+  }
+
+  for (i = 0; i < nthreads; i++)
+  {
+    init_sem(&pair_sems[i], 0);
+  }
+  set_roles(workers, 2, 0);               //pong side does not time anything
+  run("pingpong", pingpong_worker, workers);
+  for (i = 0; i < nthreads; i++)
+  {
+    init_sem(&pair_sems[i], 0);
+  }
+  run("updown", updown_worker, workers);
+  for (i = 0; i < nthreads; i++)
+  {
+    if (pair_sems[i].value != 0)
+    {
+      fprintf(stderr, "updown: pair semaphore %d left at %d\n", i, pair_sems[i].value);
+      return 1;
+    }
+  }
+
+  set_roles(workers, 1, 0);
+  workers[0].timed = 0;
+  init_sem(&abort_sem, 0);
+  init_sem(&abort_done, 0);
+  abort_running = nthreads - 1;
+  run("aborts", abort_worker, workers);
+  if (abort_sem.value != abort_released - abort_got || abort_done.value != abort_semops)
+  {
+    fprintf(stderr, "aborts: counts are %d and %d, expected %ld and %ld\n", abort_sem.value,
+            abort_done.value, abort_released - abort_got, abort_semops);
+    return 1;
+  }
+  if (sys_cs1550_stats(&abort_sem, &stats) == 0 && stats.depth != 0)
+  {
+    fprintf(stderr, "aborts: %lld waiters still counted as queued\n", stats.depth);
+    return 1;
+  }
+  printf("%-10s %ld interrupted, %ld timed out, %ld taken\n", "", abort_interrupted,
+         abort_timed_out, abort_got);
+
+  set_roles(workers, 1, 0);
+  if (map_alias() != 0)
+  {
+    return 1;
+  }
+  init_sem(alias_sems[0], 1);
+  counter = 0;
+  run("alias", alias_worker, workers);
+  if (counter != (long)nthreads * iters || alias_sems[1]->value != 1)
+  {
+    fprintf(stderr, "alias: counter is %ld, expected %ld\n", counter, (long)nthreads * iters);
+    return 1;
+  }
+  if (sys_cs1550_up_down(alias_sems[0], alias_sems[1]) != -EINVAL)
+  {
+    fprintf(stderr, "alias: up_down accepted one semaphore through two mappings\n");
+    return 1;
+  }
+
+  mutex_handle = sys_cs1550_create(1);
+  counter = 0;
+  run("handles", handle_worker, workers);
+  sys_cs1550_destroy(mutex_handle);
+  if (counter != (long)nthreads * iters)
+  {
+    fprintf(stderr, "handles: counter is %ld, expected %ld\n", counter, (long)nthreads * iters);
+    return 1;
+  }
+
+  //another user can neither use nor free a handle, and one user cannot fill the table
+  mutex_handle = sys_cs1550_create(1);
+  kshim_set_euid(main_pid, 1);
+  if (sys_cs1550_up_handle(mutex_handle) != -EACCES || sys_cs1550_destroy(mutex_handle) != -EACCES)
+  {
+    fprintf(stderr, "handles: another user got at the handle\n");
+    return 1;
+  }
+  for (i = 0; i < HANDLE_LIMIT && (user_handles[i] = sys_cs1550_create(0)) >= 0; i++)
+    ;
+  while (--i >= 0)
+  {
+    sys_cs1550_destroy(user_handles[i]);
+    held++;
+  }
+  kshim_set_euid(main_pid, 0);
+  sys_cs1550_destroy(mutex_handle);
+  if (held == HANDLE_LIMIT)
+  {
+    fprintf(stderr, "handles: one user took %d handles\n", held);
+    return 1;
+  }
+
+  //the server reads with O_NONBLOCK so a fd reported readable but already drained
+  //would show up as a short read instead of a hang
+  set_roles(workers, 1, 0);
+  workers[0].timed = 0;
+  for (i = 1; i < nthreads; i++)
+  {
+    request_handles[i] = sys_cs1550_create(0);
+    reply_handles[i] = sys_cs1550_create(0);
+    request_fds[i] = sys_cs1550_sem_fd(request_handles[i]);
+    kshim_set_nonblock(request_fds[i], 1);
+  }
+  run("pollfd", pollfd_worker, workers);
+  for (i = 1; i < nthreads; i++)
+  {
+    if (sys_cs1550_destroy(request_handles[i]) != -EBUSY)
+    {
+      fprintf(stderr, "pollfd: request semaphore %d destroyed while open\n", i);
+      return 1;
+    }
+    kshim_close(request_fds[i]);
+    if (sys_cs1550_destroy(request_handles[i]) != 0 || sys_cs1550_destroy(reply_handles[i]) != 0)
+    {
+      fprintf(stderr, "pollfd: semaphores of client %d not idle after close\n", i);
+      return 1;
+    }
+  }
+
+  //one important thread against batch threads, FIFO then ordered by nice, then with
+  //inheritance, latency is the important thread's only
+  set_roles(workers, nthreads, BATCH_NICE);
+  init_sem(&mutex, 1);
+  run("fifo-hi", mutex_worker, workers);
+  init_sem(&mutex, 1);
+  mutex.flags = CS1550_SEM_PRIO;
+  run("prio-hi", mutex_worker, workers);
+  init_sem(&mutex, 1);
+  mutex.flags = CS1550_SEM_PRIO | CS1550_SEM_PI;
+  run("pi-hi", mutex_worker, workers);
+
+  //read-heavy mix, serialized through a mutex and then shared through the rwsem
+  set_roles(workers, 1, 0);
+  init_sem(&mutex, 1);
+  counter = 0;
+  run("rw-mutex", rw_mutex_worker, workers);
+  rwsem.active = 0;
+  rwsem.waiting = 0;
+  run("rwsem", rwsem_worker, workers);
+  if (counter != 2L * nthreads * ((iters + RW_WRITE_EVERY - 1) / RW_WRITE_EVERY) || rwsem.active != 0)
+  {
+    fprintf(stderr, "rwsem: counter is %ld, active %d\n", counter, rwsem.active);
+    return 1;
+  }
+
+  //again with every FAULT_EVERY-th access to the rwsem faulting as if its page were out
+  kshim_set_fault_every(FAULT_EVERY);
+  counter = 0;
+  run("rwsem-flt", rwsem_worker, workers);
+  kshim_set_fault_every(0);
+  if (counter != (long)nthreads * ((iters + RW_WRITE_EVERY - 1) / RW_WRITE_EVERY) ||
+      rwsem.active != 0 || rwsem.waiting != 0)
+  {
+    fprintf(stderr, "rwsem-flt: counter is %ld, active %d, waiting %d\n", counter, rwsem.active,
+            rwsem.waiting);
+    return 1;
+  }
+
+  barrier.parties = nthreads;
+  barrier.arrived = 0;
+  barrier.generation = 0;
+  counter = 0;
+  run("barrier", barrier_worker, workers);
+  if (counter != iters || barrier.generation != (unsigned int)iters)
+  {
+    fprintf(stderr, "barrier: %ld openers over %u generations, expected %d\n", counter,
+            barrier.generation, iters);
+    return 1;
+  }
+  kshim_set_fault_every(FAULT_EVERY);
+  barrier.generation = 0;
+  counter = 0;
+  run("barrier-flt", barrier_worker, workers);
+  if (counter != iters || barrier.generation != (unsigned int)iters || barrier.arrived != 0)
+  {
+    fprintf(stderr, "barrier-flt: %ld openers over %u generations, expected %d\n", counter,
+            barrier.generation, iters);
+    return 1;
+  }
+
+  //every third access faults, each call must still land exactly once
+  kshim_set_fault_every(3);
+  for (i = 0; i < 5; i++)
+  {
+    if (sys_cs1550_ec_advance(&eventcount, 1) != 0)
+    {
+      fprintf(stderr, "eventcount: advance failed\n");
+      return 1;
+    }
+  }
+  if (sys_cs1550_ec_await(&eventcount, 5) != 0 || eventcount.count != 5)
+  {
+    fprintf(stderr, "eventcount: count is %u after 5 advances\n", eventcount.count);
+    return 1;
+  }
+  kshim_set_fault_every(0);
+
+  if (trace_path != NULL)
+  {
+    kshim_proc_write("cs1550_trace", "0", 1);
+    trace_done = 1;
+    pthread_join(drainer, NULL);
+    fclose(trace_out);
+  }
+  if (print_proc)
+  {
+    kshim_proc_show("cs1550_sem", stdout);
+  }
+  return 0;
+}
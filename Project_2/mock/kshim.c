@@ -0,0 +1,564 @@
+/*
+ *  CS 1550 Project 2: Producer/Consumer Problem
+ *  User-space implementation of the kernel API in kshim.h
+ *  Author: Michael Korst (mpk44@pitt.edu)
+ */
+
+#include <linux/futex.h>
+#include <stdarg.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "kshim.h"
+#include "cs1550_mock.h"
+
+__thread struct task_struct* current;
+
+static struct task_struct* tasks[KSHIM_MAX_TASKS + 1];     //indexed by pid, pid 0 unused
+static volatile int next_pid = 1;
+static struct kshim_setup* setups;
+static struct proc_dir_entry proc_entries[8];
+static int nproc_entries;
+static struct file* files[KSHIM_MAX_FILES];
+static DEFINE_SPINLOCK(files_lock);
+struct mm_struct kshim_mm;
+static volatile int fault_every;                            //0 for no injected faults
+static unsigned long fault_count;
+
+//address ranges that get_futex_key() treats as shared mappings of a file
+struct kshim_mapping
+{
+  char* start;
+  size_t len;
+  void* inode;
+  unsigned long pgoff;
+};
+
+static struct kshim_mapping mappings[8];
+static int nmappings;
+
+static long futex(volatile int* addr, int op, int val, const struct timespec* timeout)
+{
+  return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+//make the calling thread a task, returns its pid
+pid_t kshim_task_start(void)
+{
+  struct task_struct* task = (struct task_struct*)calloc(1, sizeof(struct task_struct));
+  pid_t pid = __sync_fetch_and_add(&next_pid, 1);
+
+  if (pid > KSHIM_MAX_TASKS)
+  {
+    fprintf(stderr, "kshim: more than %d tasks\n", KSHIM_MAX_TASKS);
+    exit(1);
+  }
+  task->pid = pid;
+  task->tgid = 1;
+  task->mm = &kshim_mm;
+  task->state = TASK_RUNNING;
+  task->on_cpu = 1;
+  task->cpu = (pid - 1) % NR_CPUS;
+  task->tid = (pid_t)syscall(SYS_gettid);
+  tasks[pid] = task;
+  current = task;
+  return pid;
+}
+
+//pretend a signal was delivered, the task's next check of signal_pending() sees it
+void kshim_signal(pid_t pid)
+{
+  tasks[pid]->sigpending = 1;
+  wake_up_process(tasks[pid]);
+}
+
+//the signal was handled, signal_pending() is false again
+void kshim_clear_signal(pid_t pid)
+{
+  tasks[pid]->sigpending = 0;
+}
+
+//nice value the kernel code sees, also applied to the thread if we are allowed to
+void set_user_nice(struct task_struct* task, long nice)
+{
+  task->nice = (int)nice;
+  setpriority(PRIO_PROCESS, task->tid, (int)nice);
+}
+
+void kshim_set_nice(pid_t pid, int nice)
+{
+  set_user_nice(tasks[pid], nice);
+}
+
+//0 turns injected page faults off
+void kshim_set_fault_every(int n)
+{
+  fault_every = n;
+}
+
+int kshim_fault_now(void)
+{
+  return fault_every > 0 && __sync_add_and_fetch(&fault_count, 1) % fault_every == 0;
+}
+
+//credentials the kernel code checks, every task starts out as uid 0
+void kshim_set_euid(pid_t pid, uid_t euid)
+{
+  tasks[pid]->euid = euid;
+}
+
+unsigned long kshim_parks(pid_t pid)
+{
+  return tasks[pid]->parks;
+}
+
+//treat len bytes at start as a MAP_SHARED mapping of inode from page pgoff on, so two
+//mappings of the same memory give the same keys, as they would in the kernel
+void kshim_map_shared(void* start, size_t len, void* inode, unsigned long pgoff)
+{
+  mappings[nmappings].start = (char*)start;
+  mappings[nmappings].len = len;
+  mappings[nmappings].inode = inode;
+  mappings[nmappings].pgoff = pgoff;
+  nmappings++;
+}
+
+int get_futex_key(u32* uaddr, struct rw_semaphore* fshared, union futex_key* key)
+{
+  unsigned long address = (unsigned long)uaddr;
+  int i;
+
+  if (address % sizeof(u32) != 0)
+  {
+    return -EINVAL;
+  }
+  key->both.offset = address % PAGE_SIZE;
+  for (i = 0; i < nmappings; i++)
+  {
+    struct kshim_mapping* m = &mappings[i];
+
+    if ((char*)uaddr >= m->start && (char*)uaddr < m->start + m->len)
+    {
+      key->shared.inode = m->inode;
+      key->shared.pgoff = m->pgoff + ((char*)uaddr - m->start) / PAGE_SIZE;
+      key->both.offset |= FUT_OFF_INODE;
+      return 0;
+    }
+  }
+  key->private.mm = current->mm;
+  key->private.address = address - key->both.offset;
+  return 0;
+}
+
+ktime_t ktime_get(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ktime_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+unsigned long kshim_jiffies(void)
+{
+  static ktime_t boot;
+
+  if (boot == 0)
+  {
+    boot = ktime_get();
+  }
+  return (unsigned long)((ktime_get() - boot) / (1000000000 / HZ));
+}
+
+//park until wake_up_process() or an armed hrtimer sets us running again
+void schedule(void)
+{
+  struct hrtimer_sleeper* sleeper = current->sleeper;
+
+  if (current->state == TASK_RUNNING)
+  {
+    return;                          //woken between set_current_state() and here
+  }
+  current->parks++;
+  current->on_cpu = 0;
+  while (current->state != TASK_RUNNING)
+  {
+    if (sleeper != NULL && sleeper->timer.expires != 0)
+    {
+      ktime_t left = sleeper->timer.expires - ktime_get();
+      struct timespec ts;
+
+      if (left <= 0)
+      {
+        //timer fired, same as hrtimer_wakeup()
+        sleeper->timer.expires = 0;
+        sleeper->task = NULL;
+        current->state = TASK_RUNNING;
+        break;
+      }
+      ts.tv_sec = left / 1000000000;
+      ts.tv_nsec = left % 1000000000;
+      futex(&current->state, FUTEX_WAIT, TASK_INTERRUPTIBLE, &ts);
+    } else
+    {
+      futex(&current->state, FUTEX_WAIT, TASK_INTERRUPTIBLE, NULL);
+    }
+  }
+  current->on_cpu = 1;
+}
+
+int wake_up_process(struct task_struct* task)
+{
+  if (__sync_bool_compare_and_swap(&task->state, TASK_INTERRUPTIBLE, TASK_RUNNING))
+  {
+    futex(&task->state, FUTEX_WAKE, 1, NULL);
+    return 1;
+  }
+  return 0;
+}
+
+struct task_struct* find_task_by_pid(pid_t pid)
+{
+  if (pid <= 0 || pid > KSHIM_MAX_TASKS)
+  {
+    return NULL;
+  }
+  return tasks[pid];
+}
+
+int task_curr(struct task_struct* task)
+{
+  return task->on_cpu;
+}
+
+//sysconf() reads /sys every time, and down asks on every call
+int num_online_cpus(void)
+{
+  static int cpus;
+
+  if (cpus == 0)
+  {
+    cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  return cpus;
+}
+
+//timers only fire for the task that owns them, while it sleeps in schedule()
+void hrtimer_init(struct hrtimer* timer, int clock, int mode)
+{
+  timer->expires = 0;
+}
+
+void hrtimer_init_sleeper(struct hrtimer_sleeper* sleeper, struct task_struct* task)
+{
+  sleeper->task = task;
+  task->sleeper = sleeper;
+}
+
+int hrtimer_start(struct hrtimer* timer, ktime_t time, int mode)
+{
+  timer->expires = ktime_get() + (time > 0 ? time : 1);
+  return 0;
+}
+
+int hrtimer_cancel(struct hrtimer* timer)
+{
+  struct hrtimer_sleeper* sleeper = container_of(timer, struct hrtimer_sleeper, timer);
+  int active = timer->expires != 0;
+
+  timer->expires = 0;
+  if (current->sleeper == sleeper)
+  {
+    current->sleeper = NULL;
+  }
+  return active;
+}
+
+void kshim_register_setup(struct kshim_setup* setup)
+{
+  setup->next = setups;
+  setups = setup;
+}
+
+//hand "name=value" to the matching __setup() handler, returns 0 if nobody claimed it
+int kshim_boot_option(const char* option)
+{
+  struct kshim_setup* s;
+
+  for (s = setups; s != NULL; s = s->next)
+  {
+    size_t len = strlen(s->prefix);
+    if (strncmp(option, s->prefix, len) == 0)
+    {
+      return s->fn((char*)option + len);
+    }
+  }
+  return 0;
+}
+
+struct proc_dir_entry* create_proc_entry(const char* name, int mode, struct proc_dir_entry* parent)
+{
+  if (nproc_entries == (int)(sizeof(proc_entries) / sizeof(proc_entries[0])))
+  {
+    return NULL;
+  }
+  proc_entries[nproc_entries].name = name;
+  return &proc_entries[nproc_entries++];
+}
+
+int seq_printf(struct seq_file* m, const char* fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  vfprintf(m->out, fmt, args);
+  va_end(args);
+  return 0;
+}
+
+int single_open(struct file* file, int (*show)(struct seq_file*, void*), void* data)
+{
+  file->seq.show = show;
+  return 0;
+}
+
+int single_release(struct inode* inode, struct file* file)
+{
+  return 0;
+}
+
+//whole file is produced in one call, straight to the stream
+ssize_t seq_read(struct file* file, char* buf, size_t size, loff_t* pos)
+{
+  return file->seq.show(&file->seq, NULL);
+}
+
+loff_t seq_lseek(struct file* file, loff_t offset, int whence)
+{
+  return 0;
+}
+
+static struct proc_dir_entry* kshim_proc_find(const char* name)
+{
+  int i;
+
+  for (i = 0; i < nproc_entries; i++)
+  {
+    if (strcmp(proc_entries[i].name, name) == 0)
+    {
+      return &proc_entries[i];
+    }
+  }
+  return NULL;
+}
+
+//print /proc/<name> to out, returns -1 if nothing registered that name
+int kshim_proc_show(const char* name, FILE* out)
+{
+  struct proc_dir_entry* entry = kshim_proc_find(name);
+  struct file file;
+
+  if (entry == NULL)
+  {
+    return -1;
+  }
+  file.seq.out = out;
+  entry->proc_fops->open(NULL, &file);
+  entry->proc_fops->read(&file, NULL, 0, NULL);
+  entry->proc_fops->release(NULL, &file);
+  return 0;
+}
+
+//read() or write() of /proc/<name> through the entry's own methods, -ENOENT if none
+ssize_t kshim_proc_read(const char* name, void* buf, size_t count)
+{
+  struct proc_dir_entry* entry = kshim_proc_find(name);
+  struct file file;
+
+  if (entry == NULL || entry->proc_fops->read == NULL)
+  {
+    return -ENOENT;
+  }
+  memset(&file, 0, sizeof(file));
+  return entry->proc_fops->read(&file, (char*)buf, count, NULL);
+}
+
+ssize_t kshim_proc_write(const char* name, const void* buf, size_t count)
+{
+  struct proc_dir_entry* entry = kshim_proc_find(name);
+  struct file file;
+
+  if (entry == NULL || entry->proc_fops->write == NULL)
+  {
+    return -ENOENT;
+  }
+  memset(&file, 0, sizeof(file));
+  return entry->proc_fops->write(&file, (const char*)buf, count, NULL);
+}
+
+void wake_up_interruptible(wait_queue_head_t* q)
+{
+  wait_queue_t* wait;
+
+  spin_lock(&q->lock);
+  list_for_each_entry(wait, &q->task_list, task_list)
+  {
+    wake_up_process(wait->task);
+  }
+  spin_unlock(&q->lock);
+}
+
+int anon_inode_getfd(int* pfd, struct inode** pinode, struct file** pfile, const char* name,
+                     const struct file_operations* fops, void* priv)
+{
+  struct file* file = (struct file*)calloc(1, sizeof(struct file));
+  int fd;
+
+  file->f_op = fops;
+  file->f_flags = O_RDWR;
+  file->private_data = priv;
+  spin_lock(&files_lock);
+  for (fd = 0; fd < KSHIM_MAX_FILES && files[fd] != NULL; fd++);
+  if (fd == KSHIM_MAX_FILES)
+  {
+    spin_unlock(&files_lock);
+    free(file);
+    return -EMFILE;
+  }
+  files[fd] = file;
+  spin_unlock(&files_lock);
+  *pfd = fd;
+  *pinode = NULL;
+  *pfile = file;
+  return 0;
+}
+
+static struct file* kshim_file(int fd)
+{
+  if (fd < 0 || fd >= KSHIM_MAX_FILES)
+  {
+    return NULL;
+  }
+  return files[fd];
+}
+
+ssize_t kshim_read(int fd, void* buf, size_t count)
+{
+  struct file* file = kshim_file(fd);
+
+  if (file == NULL || file->f_op->read == NULL)
+  {
+    return -EBADF;
+  }
+  return file->f_op->read(file, (char*)buf, count, NULL);
+}
+
+void kshim_set_nonblock(int fd, int nonblock)
+{
+  struct file* file = kshim_file(fd);
+
+  if (nonblock)
+  {
+    file->f_flags |= O_NONBLOCK;
+  } else
+  {
+    file->f_flags &= ~O_NONBLOCK;
+  }
+}
+
+int kshim_close(int fd)
+{
+  struct file* file = kshim_file(fd);
+
+  if (file == NULL)
+  {
+    return -EBADF;
+  }
+  spin_lock(&files_lock);
+  files[fd] = NULL;
+  spin_unlock(&files_lock);
+  if (file->f_op->release != NULL)
+  {
+    file->f_op->release(NULL, file);
+  }
+  free(file);
+  return 0;
+}
+
+//one registration per wait queue a poll method asked for
+struct kshim_poll_table
+{
+  poll_table pt;
+  int n;
+  wait_queue_t waits[KSHIM_MAX_FILES];
+  wait_queue_head_t* heads[KSHIM_MAX_FILES];
+};
+
+static void kshim_poll_queue(struct file* file, wait_queue_head_t* q, poll_table* pt)
+{
+  struct kshim_poll_table* table = container_of(pt, struct kshim_poll_table, pt);
+
+  if (table->n == KSHIM_MAX_FILES)
+  {
+    return;
+  }
+  table->waits[table->n].task = current;
+  table->heads[table->n] = q;
+  add_wait_queue(q, &table->waits[table->n]);
+  table->n++;
+}
+
+//poll(2) over kshim descriptors, the same loop as the kernel's do_poll(): every file is
+//asked once with the table so it can queue us, after that only rechecked after a wakeup
+//timeout is in ms, -1 waits for ever, returns the number of fds with events
+int kshim_poll(struct pollfd* fds, int nfds, int timeout)
+{
+  struct kshim_poll_table* table = (struct kshim_poll_table*)calloc(1, sizeof(struct kshim_poll_table));
+  struct hrtimer_sleeper sleeper;
+  poll_table* pt = &table->pt;
+  int count = 0;
+  int i;
+
+  table->pt.qproc = kshim_poll_queue;
+  if (timeout > 0)
+  {
+    hrtimer_init(&sleeper.timer, 0, HRTIMER_MODE_REL);
+    hrtimer_init_sleeper(&sleeper, current);
+    hrtimer_start(&sleeper.timer, (ktime_t)timeout * 1000000, HRTIMER_MODE_REL);
+  }
+  for (;;)
+  {
+    set_current_state(TASK_INTERRUPTIBLE);
+    for (i = 0; i < nfds; i++)
+    {
+      struct file* file = kshim_file(fds[i].fd);
+
+      if (file == NULL)
+      {
+        fds[i].revents = POLLNVAL;
+      } else
+      {
+        fds[i].revents = file->f_op->poll(file, pt) & (fds[i].events | POLLERR | POLLHUP);
+      }
+      if (fds[i].revents)
+      {
+        count++;
+      }
+    }
+    pt = NULL;
+    if (count > 0 || timeout == 0 || (timeout > 0 && sleeper.task == NULL))
+    {
+      break;
+    }
+    schedule();
+  }
+  __set_current_state(TASK_RUNNING);
+  if (timeout > 0)
+  {
+    hrtimer_cancel(&sleeper.timer);
+  }
+  for (i = 0; i < table->n; i++)
+  {
+    remove_wait_queue(table->heads[i], &table->waits[i]);
+  }
+  free(table);
+  return count;
+}
@@ -0,0 +1,571 @@
+/*
+ *  CS 1550 Project 2: Producer/Consumer Problem
+ *  Just enough of the 2.6.23 kernel API to build the cs1550 code in sys.c as a user program
+ *  Author: Michael Korst (mpk44@pitt.edu)
+ *
+ *  Tasks are threads: current is thread local, schedule() parks the thread on a futex
+ *  and wake_up_process() unparks it, spinlocks spin on an atomic int. Every thread that
+ *  calls into the semaphore code must call kshim_task_start() first. Files made with
+ *  anon_inode_getfd() get descriptors of their own, used through kshim_read(),
+ *  kshim_poll() and kshim_close().
+ */
+
+#ifndef KSHIM_H
+#define KSHIM_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define KSHIM_MAX_TASKS 256
+#define NR_CPUS 64                 //per-CPU variables get this many copies, one per task slot
+
+//annotations with no meaning outside the kernel
+#define asmlinkage
+#define __user
+#define __init
+#define ____cacheline_aligned_in_smp __attribute__((aligned(64)))
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+typedef unsigned int u32;
+typedef unsigned long long u64;
+typedef long long s64;
+
+//tasks
+#define TASK_RUNNING 0
+#define TASK_INTERRUPTIBLE 1
+
+struct hrtimer_sleeper;
+struct mm_struct;
+
+struct task_struct
+{
+  pid_t pid;
+  struct mm_struct* mm;            //every task shares kshim_mm, tasks are threads of one process
+  volatile int state;              //futex word, TASK_INTERRUPTIBLE while parked or about to park
+  volatile int on_cpu;             //cleared while parked in schedule()
+  int cpu;                         //index into per-CPU arrays
+  struct hrtimer_sleeper* sleeper; //armed timeout for the next schedule(), if any
+  volatile int sigpending;         //set by kshim_signal()
+  unsigned long parks;             //schedule() calls that actually slept
+  pid_t tid;                       //thread id, for setpriority()
+  int nice;
+  pid_t tgid;                      //all tasks are threads of process 1
+  uid_t uid, euid;
+};
+
+extern __thread struct task_struct* current;
+
+#define set_current_state(s) __atomic_store_n(&current->state, (s), __ATOMIC_SEQ_CST)
+#define __set_current_state(s) (current->state = (s))
+
+void schedule(void);
+int wake_up_process(struct task_struct* task);
+struct task_struct* find_task_by_pid(pid_t pid);
+int task_curr(struct task_struct* task);
+int num_online_cpus(void);
+void set_user_nice(struct task_struct* task, long nice);
+
+static inline int task_nice(struct task_struct* task)
+{
+  return task->nice;
+}
+
+static inline int signal_pending(struct task_struct* task)
+{
+  return task->sigpending;
+}
+
+//credentials, nobody has capabilities and nice is only limited by setpriority() itself
+#define CAP_IPC_OWNER 15
+#define CAP_SYS_NICE 23
+
+static inline int capable(int cap)
+{
+  return 0;
+}
+
+static inline int can_nice(const struct task_struct* task, int nice)
+{
+  return 1;
+}
+
+//task references, tasks are never freed
+static inline void get_task_struct(struct task_struct* task)
+{
+}
+
+static inline void put_task_struct(struct task_struct* task)
+{
+}
+
+static inline int need_resched(void)
+{
+  return 0;
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+static inline void rcu_read_lock(void)
+{
+}
+
+static inline void rcu_read_unlock(void)
+{
+}
+
+//spinlocks, test and test-and-set on an int so the kernel's static initializers work,
+//glibc's pthread_spinlock_t needs pthread_spin_init() and is not 0 when unlocked on x86
+typedef struct
+{
+  volatile int locked;
+} spinlock_t;
+
+#define __SPIN_LOCK_UNLOCKED(x) { 0 }
+#define DEFINE_SPINLOCK(x) spinlock_t x = __SPIN_LOCK_UNLOCKED(x)
+#define spin_lock_init(l) ((l)->locked = 0)
+#define KSHIM_SPINS_BEFORE_YIELD 100
+
+//a kernel lock holder cannot be preempted, ours can, so give up the CPU now and then
+//instead of spinning away a whole time slice behind it
+static inline void spin_lock(spinlock_t* lock)
+{
+  int spins = 0;
+
+  while (__sync_lock_test_and_set(&lock->locked, 1))
+  {
+    while (lock->locked)
+    {
+      if (++spins == KSHIM_SPINS_BEFORE_YIELD)
+      {
+        sched_yield();
+        spins = 0;
+      } else
+      {
+        cpu_relax();
+      }
+    }
+  }
+}
+
+static inline void spin_unlock(spinlock_t* lock)
+{
+  __sync_lock_release(&lock->locked);
+}
+
+//atomics
+typedef struct
+{
+  volatile int counter;
+} atomic_t;
+
+static inline int atomic_read(atomic_t* a)
+{
+  return a->counter;
+}
+
+static inline void atomic_inc(atomic_t* a)
+{
+  __sync_add_and_fetch(&a->counter, 1);
+}
+
+static inline int atomic_inc_return(atomic_t* a)
+{
+  return __sync_add_and_fetch(&a->counter, 1);
+}
+
+static inline int atomic_dec_return(atomic_t* a)
+{
+  return __sync_sub_and_fetch(&a->counter, 1);
+}
+
+static inline int atomic_cmpxchg(atomic_t* a, int old, int new_val)
+{
+  return __sync_val_compare_and_swap(&a->counter, old, new_val);
+}
+
+//per-CPU data, each task slot is its own CPU
+#define DEFINE_PER_CPU(type, name) type per_cpu__##name[NR_CPUS]
+#define per_cpu(name, cpu) (per_cpu__##name[cpu])
+#define __get_cpu_var(name) (per_cpu__##name[current->cpu])
+#define get_cpu_var(name) __get_cpu_var(name)
+#define put_cpu_var(name) ((void)0)
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < NR_CPUS; (cpu)++)
+
+//hashing, same multipliers as linux/hash.h
+#define GOLDEN_RATIO_PRIME_32 0x9e370001UL
+#define GOLDEN_RATIO_PRIME_64 0x9e37fffffffc0001UL
+
+static inline unsigned long hash_long(unsigned long val, unsigned int bits)
+{
+  if (sizeof(long) == 8)
+  {
+    return (unsigned long)((unsigned long long)val * GOLDEN_RATIO_PRIME_64) >> (64 - bits);
+  }
+  return (val * GOLDEN_RATIO_PRIME_32) >> (32 - bits);
+}
+
+static inline unsigned long hash_ptr(void* ptr, unsigned int bits)
+{
+  return hash_long((unsigned long)ptr, bits);
+}
+
+//intrusive lists
+struct list_head
+{
+  struct list_head* next;
+  struct list_head* prev;
+};
+
+#define container_of(ptr, type, member) ((type*)((char*)(ptr) - offsetof(type, member)))
+
+static inline void INIT_LIST_HEAD(struct list_head* list)
+{
+  list->next = list;
+  list->prev = list;
+}
+
+static inline void list_add_tail(struct list_head* node, struct list_head* head)
+{
+  node->prev = head->prev;
+  node->next = head;
+  head->prev->next = node;
+  head->prev = node;
+}
+
+static inline void list_del(struct list_head* node)
+{
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+}
+
+static inline int list_empty(const struct list_head* head)
+{
+  return head->next == head;
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+
+#define list_for_each_entry(pos, head, member) \
+  for (pos = container_of((head)->next, __typeof__(*pos), member); \
+       &pos->member != (head); \
+       pos = container_of(pos->member.next, __typeof__(*pos), member))
+
+#define list_for_each_entry_safe(pos, n, head, member) \
+  for (pos = container_of((head)->next, __typeof__(*pos), member), \
+       n = container_of(pos->member.next, __typeof__(*pos), member); \
+       &pos->member != (head); \
+       pos = n, n = container_of(n->member.next, __typeof__(*n), member))
+
+//wait queues, woken tasks are unparked with wake_up_process()
+typedef struct
+{
+  spinlock_t lock;
+  struct list_head task_list;
+} wait_queue_head_t;
+
+typedef struct
+{
+  struct task_struct* task;
+  struct list_head task_list;
+} wait_queue_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t* q)
+{
+  q->lock.locked = 0;
+  INIT_LIST_HEAD(&q->task_list);
+}
+
+static inline int waitqueue_active(wait_queue_head_t* q)
+{
+  return q->task_list.next != &q->task_list;
+}
+
+static inline void add_wait_queue(wait_queue_head_t* q, wait_queue_t* wait)
+{
+  spin_lock(&q->lock);
+  list_add_tail(&wait->task_list, &q->task_list);
+  spin_unlock(&q->lock);
+}
+
+static inline void remove_wait_queue(wait_queue_head_t* q, wait_queue_t* wait)
+{
+  spin_lock(&q->lock);
+  list_del(&wait->task_list);
+  spin_unlock(&q->lock);
+}
+
+//address space, one for all tasks, mmap_sem is never contended since nothing here maps
+//or unmaps while the semaphore code runs
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+
+struct rw_semaphore
+{
+  int unused;
+};
+
+struct mm_struct
+{
+  struct rw_semaphore mmap_sem;
+};
+
+extern struct mm_struct kshim_mm;
+
+static inline void down_read(struct rw_semaphore* sem)
+{
+}
+
+static inline void up_read(struct rw_semaphore* sem)
+{
+}
+
+//futex keys, laid out as in linux/futex.h: private memory is keyed by mm and page address,
+//ranges registered with kshim_map_shared() by a stand-in inode and page offset
+#define FUT_OFF_INODE 1
+#define FUT_OFF_MMSHARED 2
+
+union futex_key
+{
+  struct
+  {
+    unsigned long pgoff;
+    void* inode;
+    int offset;
+  } shared;
+  struct
+  {
+    unsigned long address;
+    struct mm_struct* mm;
+    int offset;
+  } private;
+  struct
+  {
+    unsigned long word;
+    void* ptr;
+    int offset;
+  } both;
+};
+
+int get_futex_key(u32* uaddr, struct rw_semaphore* fshared, union futex_key* key);
+
+static inline void get_futex_key_refs(union futex_key* key)
+{
+}
+
+static inline void drop_futex_key_refs(union futex_key* key)
+{
+}
+
+//user memory is our own memory
+static inline unsigned long copy_from_user(void* to, const void* from, unsigned long n)
+{
+  memcpy(to, from, n);
+  return 0;
+}
+
+static inline unsigned long copy_to_user(void* to, const void* from, unsigned long n)
+{
+  memcpy(to, from, n);
+  return 0;
+}
+
+//page faults: user memory is always there, but after kshim_set_fault_every(n) every n-th
+//copy made with faults disabled fails as if its page were out, so the retry paths run
+#define PAGE_MASK (~(PAGE_SIZE - 1))
+
+struct page;
+struct vm_area_struct;
+
+static inline void pagefault_disable(void)
+{
+}
+
+static inline void pagefault_enable(void)
+{
+}
+
+int kshim_fault_now(void);
+
+static inline unsigned long __copy_from_user_inatomic(void* to, const void* from, unsigned long n)
+{
+  if (kshim_fault_now())
+  {
+    return n;
+  }
+  memcpy(to, from, n);
+  return 0;
+}
+
+static inline unsigned long __copy_to_user_inatomic(void* to, const void* from, unsigned long n)
+{
+  if (kshim_fault_now())
+  {
+    return n;
+  }
+  memcpy(to, from, n);
+  return 0;
+}
+
+//faulting in always works, the page is ours
+static inline int get_user_pages(struct task_struct* tsk, struct mm_struct* mm, unsigned long start,
+                                 int len, int write, int force, struct page** pages,
+                                 struct vm_area_struct** vmas)
+{
+  pages[0] = NULL;
+  return len;
+}
+
+static inline void put_page(struct page* page)
+{
+}
+
+//time and high resolution timers, ktime_t is plain nanoseconds
+typedef s64 ktime_t;
+
+#define HRTIMER_MODE_REL 1
+
+struct hrtimer
+{
+  ktime_t expires;                 //absolute CLOCK_MONOTONIC ns, 0 while not armed
+};
+
+struct hrtimer_sleeper
+{
+  struct hrtimer timer;
+  struct task_struct* task;        //cleared when the timer fires
+};
+
+ktime_t ktime_get(void);
+
+//jiffies tick at HZ, counted from the first look
+#define HZ 1000
+#define jiffies kshim_jiffies()
+#define time_after(a, b) ((long)((b) - (a)) < 0)
+
+unsigned long kshim_jiffies(void);
+#define ktime_sub(a, b) ((a) - (b))
+#define ktime_to_ns(a) (a)
+
+static inline int timespec_valid(const struct timespec* ts)
+{
+  return ts->tv_sec >= 0 && ts->tv_nsec >= 0 && ts->tv_nsec < 1000000000;
+}
+
+static inline ktime_t timespec_to_ktime(struct timespec ts)
+{
+  return (ktime_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void hrtimer_init(struct hrtimer* timer, int clock, int mode);
+void hrtimer_init_sleeper(struct hrtimer_sleeper* sleeper, struct task_struct* task);
+int hrtimer_start(struct hrtimer* timer, ktime_t time, int mode);
+int hrtimer_cancel(struct hrtimer* timer);
+
+//boot options, __setup handlers are collected and run by kshim_boot_option()
+struct kshim_setup
+{
+  const char* prefix;
+  int (*fn)(char*);
+  struct kshim_setup* next;
+};
+
+void kshim_register_setup(struct kshim_setup* setup);
+
+#define __setup(str, fn) \
+  static struct kshim_setup fn##_kshim = { str, fn, NULL }; \
+  static void __attribute__((constructor)) fn##_kshim_register(void) { kshim_register_setup(&fn##_kshim); }
+
+static inline int get_option(char** str, int* val)
+{
+  *val = (int)strtol(*str, str, 0);
+  return 1;
+}
+
+//initcalls run before main()
+#define __initcall(fn) \
+  static void __attribute__((constructor)) fn##_kshim_init(void) { fn(); }
+
+//procfs, a registered entry can be dumped with kshim_proc_show(), or read and written
+//with kshim_proc_read() and kshim_proc_write() if it has its own read and write
+struct seq_file
+{
+  FILE* out;
+  int (*show)(struct seq_file*, void*);
+};
+
+struct inode;
+
+struct file
+{
+  struct seq_file seq;
+  const struct file_operations* f_op;
+  unsigned int f_flags;
+  void* private_data;
+};
+
+struct poll_table_struct;
+
+struct file_operations
+{
+  int (*open)(struct inode*, struct file*);
+  ssize_t (*read)(struct file*, char*, size_t, loff_t*);
+  ssize_t (*write)(struct file*, const char*, size_t, loff_t*);
+  loff_t (*llseek)(struct file*, loff_t, int);
+  unsigned int (*poll)(struct file*, struct poll_table_struct*);
+  int (*release)(struct inode*, struct file*);
+};
+
+struct proc_dir_entry
+{
+  const char* name;
+  const struct file_operations* proc_fops;
+};
+
+#define S_IRUGO 0444
+
+struct proc_dir_entry* create_proc_entry(const char* name, int mode, struct proc_dir_entry* parent);
+int seq_printf(struct seq_file* m, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+int single_open(struct file* file, int (*show)(struct seq_file*, void*), void* data);
+int single_release(struct inode* inode, struct file* file);
+ssize_t seq_read(struct file* file, char* buf, size_t size, loff_t* pos);
+loff_t seq_lseek(struct file* file, loff_t offset, int whence);
+
+//poll, the table's qproc is called for every wait queue a file's poll method waits on
+typedef struct poll_table_struct
+{
+  void (*qproc)(struct file*, wait_queue_head_t*, struct poll_table_struct*);
+} poll_table;
+
+static inline void poll_wait(struct file* filp, wait_queue_head_t* q, poll_table* p)
+{
+  if (p != NULL && q != NULL)
+  {
+    p->qproc(filp, q, p);
+  }
+}
+
+void wake_up_interruptible(wait_queue_head_t* q);
+
+//anonymous files, the descriptors index a table in kshim.c, not the process's fd table
+#define KSHIM_MAX_FILES 256
+
+int anon_inode_getfd(int* pfd, struct inode** pinode, struct file** pfile, const char* name,
+                     const struct file_operations* fops, void* priv);
+
+#endif
@@ -0,0 +1,399 @@
+/*
+ *  CS 1550 Project 2: Producer/Consumer Problem
+ *  Semaphore benchmark suite with interchangeable semaphore implementations
+ *  Author: Michael Korst (mpk44@pitt.edu)
+ *
+ *  Usage: sembench [-b backend]... [-n iterations] [-p producers] [-c consumers] [-s slots]
+ *  Runs three tests on every backend given with -b, or on all of them:
+ *    uncontended: down+up on a semaphore only one process uses, ns per pair, sampled
+ *                 as the average of each batch of UNCONTENDED_BATCH pairs
+ *    pingpong:    two processes bounce a unit between two semaphores, ns per round trip
+ *    buffer:      producers and consumers share a bounded buffer guarded by empty, full
+ *                 and mutex semaphores, as in the producer/consumer project, ns from an
+ *                 item being produced to being consumed
+ *  Each line gives operations per second and latency percentiles. Backends:
+ *    cs1550       the cs1550 syscalls on every call
+ *    cs1550-fast  the cs1550.h fast path, entering the kernel only to sleep or wake
+ *    posix        process-shared POSIX semaphores
+ *    futex        a counting semaphore on a raw futex, the fast path's lower bound
+ *  Link with -pthread for the POSIX semaphores.
+ */
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include "cs1550.h"
+
+#define DEFAULT_ITERS 100000
+#define DEFAULT_PRODUCERS 2
+#define DEFAULT_CONSUMERS 2
+#define DEFAULT_SLOTS 16
+#define MAX_SLOTS 1024
+#define UNCONTENDED_BATCH 100
+
+//counting semaphore on one futex word, value never goes below 0 and sleepers are counted
+//so up can skip the wake syscall when nobody waits
+struct futex_sem
+{
+  volatile int value;
+  volatile int sleepers;
+};
+
+//one semaphore of any backend, always in shared memory
+union any_sem
+{
+  struct cs1550_sem cs;
+  sem_t posix;
+  struct futex_sem fx;
+};
+
+struct backend
+{
+  const char* name;
+  void (*init)(union any_sem* s, int value);
+  void (*down)(union any_sem* s);
+  void (*up)(union any_sem* s);
+};
+
+static void cs1550_init(union any_sem* s, int value)
+{
+  s->cs.value = value;
+  s->cs.flags = 0;
+}
+
+static void cs1550_syscall_down(union any_sem* s)
+{
+  while (cs1550_down(&s->cs) == -1 && errno == EINTR);
+}
+
+static void cs1550_syscall_up(union any_sem* s)
+{
+  cs1550_up(&s->cs);
+}
+
+static void cs1550_fast_down(union any_sem* s)
+{
+  down(&s->cs);
+}
+
+static void cs1550_fast_up(union any_sem* s)
+{
+  up(&s->cs);
+}
+
+static void posix_init(union any_sem* s, int value)
+{
+  sem_init(&s->posix, 1, value);
+}
+
+static void posix_down(union any_sem* s)
+{
+  while (sem_wait(&s->posix) == -1 && errno == EINTR);
+}
+
+static void posix_up(union any_sem* s)
+{
+  sem_post(&s->posix);
+}
+
+static void futex_init(union any_sem* s, int value)
+{
+  s->fx.value = value;
+  s->fx.sleepers = 0;
+}
+
+static void futex_down(union any_sem* s)
+{
+  struct futex_sem* fx = &s->fx;
+
+  for (;;)
+  {
+    int v = fx->value;
+
+    while (v > 0)
+    {
+      int seen = __sync_val_compare_and_swap(&fx->value, v, v - 1);
+      if (seen == v)
+      {
+        return;
+      }
+      v = seen;
+    }
+    //the kernel only sleeps if value is still 0, so an up after our look is not missed
+    __sync_fetch_and_add(&fx->sleepers, 1);
+    syscall(SYS_futex, &fx->value, FUTEX_WAIT, 0, NULL, NULL, 0);
+    __sync_fetch_and_sub(&fx->sleepers, 1);
+  }
+}
+
+static void futex_up(union any_sem* s)
+{
+  struct futex_sem* fx = &s->fx;
+
+  __sync_fetch_and_add(&fx->value, 1);
+  if (fx->sleepers > 0)
+  {
+    syscall(SYS_futex, &fx->value, FUTEX_WAKE, 1, NULL, NULL, 0);
+  }
+}
+
+static const struct backend backends[] = {
+  { "cs1550", cs1550_init, cs1550_syscall_down, cs1550_syscall_up },
+  { "cs1550-fast", cs1550_init, cs1550_fast_down, cs1550_fast_up },
+  { "posix", posix_init, posix_down, posix_up },
+  { "futex", futex_init, futex_down, futex_up },
+};
+
+#define NBACKENDS (int)(sizeof(backends) / sizeof(backends[0]))
+
+//everything the processes share, one MAP_SHARED mapping
+struct shared
+{
+  union any_sem a, b;                 //uncontended and pingpong
+  union any_sem empty, full, mutex;   //bounded buffer
+  int in, out;                        //next slot to fill and to empty, guarded by mutex
+  unsigned long long slots[MAX_SLOTS];  //time each item was produced
+  unsigned long long nsamples;        //next free entry in samples
+  unsigned long long samples[];       //ns per operation, filled by whichever process timed it
+};
+
+static int iters = DEFAULT_ITERS;
+static int producers = DEFAULT_PRODUCERS;
+static int consumers = DEFAULT_CONSUMERS;
+static int nslots = DEFAULT_SLOTS;
+
+static unsigned long long now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_ull(const void* a, const void* b)
+{
+  unsigned long long x = *(const unsigned long long*)a;
+  unsigned long long y = *(const unsigned long long*)b;
+  return x < y ? -1 : x > y;
+}
+
+static void report(const char* backend, const char* test, unsigned long long ops,
+                   unsigned long long elapsed, struct shared* sh)
+{
+  unsigned long long* s = sh->samples;
+  unsigned long long n = sh->nsamples;
+
+  qsort(s, n, sizeof(unsigned long long), cmp_ull);
+  printf("%-12s %-12s %12.0f %10llu %10llu %10llu %10llu\n", backend, test,
+         ops / (elapsed / 1e9), s[n / 2], s[n * 9 / 10], s[n * 99 / 100], s[n - 1]);
+  fflush(stdout);                     //or every child forked later prints it again on exit
+}
+
+static void uncontended(const struct backend* be, struct shared* sh)
+{
+  unsigned long long start, t;
+  int i, j;
+
+  be->init(&sh->a, 1);
+  sh->nsamples = 0;
+  start = now_ns();
+  for (i = 0; i < iters / UNCONTENDED_BATCH; i++)
+  {
+    t = now_ns();
+    for (j = 0; j < UNCONTENDED_BATCH; j++)
+    {
+      be->down(&sh->a);
+      be->up(&sh->a);
+    }
+    sh->samples[sh->nsamples++] = (now_ns() - t) / UNCONTENDED_BATCH;
+  }
+  report(be->name, "uncontended", (unsigned long long)i * UNCONTENDED_BATCH, now_ns() - start, sh);
+}
+
+static void pingpong(const struct backend* be, struct shared* sh)
+{
+  unsigned long long start, t;
+  int i;
+
+  be->init(&sh->a, 0);
+  be->init(&sh->b, 0);
+  sh->nsamples = 0;
+  if (fork() == 0)
+  {
+    for (i = 0; i < iters; i++)
+    {
+      be->down(&sh->a);
+      be->up(&sh->b);
+    }
+    exit(0);
+  }
+  start = now_ns();
+  for (i = 0; i < iters; i++)
+  {
+    t = now_ns();
+    be->up(&sh->a);
+    be->down(&sh->b);
+    sh->samples[sh->nsamples++] = now_ns() - t;
+  }
+  wait(NULL);
+  report(be->name, "pingpong", iters, now_ns() - start, sh);
+}
+
+static void produce(const struct backend* be, struct shared* sh, int items)
+{
+  int i;
+
+  for (i = 0; i < items; i++)
+  {
+    be->down(&sh->empty);
+    be->down(&sh->mutex);
+    sh->slots[sh->in] = now_ns();
+    sh->in = (sh->in + 1) % nslots;
+    be->up(&sh->mutex);
+    be->up(&sh->full);
+  }
+}
+
+static void consume(const struct backend* be, struct shared* sh, int items)
+{
+  unsigned long long made;
+  int i;
+
+  for (i = 0; i < items; i++)
+  {
+    be->down(&sh->full);
+    be->down(&sh->mutex);
+    made = sh->slots[sh->out];
+    sh->out = (sh->out + 1) % nslots;
+    sh->samples[sh->nsamples++] = now_ns() - made;    //mutex guards nsamples too
+    be->up(&sh->mutex);
+    be->up(&sh->empty);
+  }
+}
+
+//iters items in total, split as evenly as possible over producers and over consumers
+static void buffer(const struct backend* be, struct shared* sh)
+{
+  unsigned long long start;
+  int i;
+
+  be->init(&sh->empty, nslots);
+  be->init(&sh->full, 0);
+  be->init(&sh->mutex, 1);
+  sh->in = 0;
+  sh->out = 0;
+  sh->nsamples = 0;
+  start = now_ns();
+  for (i = 0; i < producers + consumers; i++)
+  {
+    if (fork() == 0)
+    {
+      if (i < producers)
+      {
+        produce(be, sh, iters / producers + (i < iters % producers));
+      } else
+      {
+        int c = i - producers;
+        consume(be, sh, iters / consumers + (c < iters % consumers));
+      }
+      exit(0);
+    }
+  }
+  while (wait(NULL) > 0);
+  report(be->name, "buffer", iters, now_ns() - start, sh);
+}
+
+static const struct backend* find_backend(const char* name)
+{
+  int i;
+
+  for (i = 0; i < NBACKENDS; i++)
+  {
+    if (strcmp(backends[i].name, name) == 0)
+    {
+      return &backends[i];
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char** argv)
+{
+  const struct backend* chosen[NBACKENDS];
+  int nchosen = 0;
+  struct shared* sh;
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "b:n:p:c:s:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'b':
+        if (nchosen == NBACKENDS || (chosen[nchosen] = find_backend(optarg)) == NULL)
+        {
+          fprintf(stderr, "unknown backend %s, choose from cs1550, cs1550-fast, posix, futex\n", optarg);
+          return 1;
+        }
+        nchosen++;
+        break;
+      case 'n':
+        iters = atoi(optarg);
+        break;
+      case 'p':
+        producers = atoi(optarg);
+        break;
+      case 'c':
+        consumers = atoi(optarg);
+        break;
+      case 's':
+        nslots = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-b backend]... [-n iterations] [-p producers] [-c consumers] [-s slots]\n",
+                argv[0]);
+        return 1;
+    }
+  }
+  if (iters < UNCONTENDED_BATCH || producers < 1 || consumers < 1 || nslots < 1 || nslots > MAX_SLOTS)
+  {
+    fprintf(stderr, "need at least %d iterations, one producer and consumer, and 1 to %d slots\n",
+            UNCONTENDED_BATCH, MAX_SLOTS);
+    return 1;
+  }
+  if (nchosen == 0)
+  {
+    for (i = 0; i < NBACKENDS; i++)
+    {
+      chosen[nchosen++] = &backends[i];
+    }
+  }
+
+  //shared with every child, which all see the semaphores the parent set up
+  sh = (struct shared*)mmap(NULL, sizeof(struct shared) + sizeof(unsigned long long) * iters,
+  PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, 0, 0);
+  if (sh == MAP_FAILED)
+  {
+    perror("mmap");
+    return 1;
+  }
+
+  printf("%d iterations, %d producers, %d consumers, %d slots\n", iters, producers, consumers, nslots);
+  printf("%-12s %-12s %12s %10s %10s %10s %10s\n", "backend", "test", "ops/s", "p50 ns", "p90 ns",
+         "p99 ns", "max ns");
+  fflush(stdout);
+  for (i = 0; i < nchosen; i++)
+  {
+    uncontended(chosen[i], sh);
+    pingpong(chosen[i], sh);
+    buffer(chosen[i], sh);
+  }
+  return 0;
+}
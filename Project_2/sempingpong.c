@@ -0,0 +1,305 @@
+/*
+ *  CS 1550 Project 2: Producer/Consumer Problem
+ *  Compares the cs1550 user-space fast path against raw syscalls
+ *  Author: Michael Korst (mpk44@pitt.edu)
+ *
+ *  Usage: sempingpong [iterations]
+ *  Reports nanoseconds per uncontended down()+up() on one process, then the
+ *  round trip time of two processes ping-ponging on a pair of semaphores,
+ *  each once through the syscall wrappers, once through the fast path, once
+ *  with cs1550_up_down() doing each side's up and down in one call, once on
+ *  kernel-managed semaphores named by handle, and once more by handle with
+ *  one side waiting in poll() on a semaphore fd.
+ *  Last, two processes take turns holding one mutex for a short critical
+ *  section, which is where spinning in the kernel down should save context
+ *  switches. Each line also shows context switches per operation.
+ */
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <poll.h>
+
+#include "cs1550.h"
+
+#define DEFAULT_ITERS 1000000
+#define HOLD_WORK 200           //loop iterations spent inside the mutex per hold
+
+static double now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//voluntary and involuntary context switches by us and our reaped children
+static long switches()
+{
+  struct rusage self, children;
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &children);
+  return self.ru_nvcsw + self.ru_nivcsw + children.ru_nvcsw + children.ru_nivcsw;
+}
+
+static void init_sem(struct cs1550_sem* sem, int value)
+{
+  sem->value = value;
+  sem->flags = 0;
+}
+
+//ns per down+up on a semaphore nobody else touches
+static double uncontended(struct cs1550_sem* sem, int iters, int fast)
+{
+  double start = now_ns();
+  int i;
+
+  init_sem(sem, 1);
+  for (i = 0; i < iters; i++)
+  {
+    if (fast)
+    {
+      down(sem);
+      up(sem);
+    } else
+    {
+      cs1550_down(sem);
+      cs1550_up(sem);
+    }
+  }
+  return (now_ns() - start) / iters;
+}
+
+//ns per round trip between two processes
+static double ping_pong(struct cs1550_sem* sems, int iters, int fast)
+{
+  double start;
+  int i;
+
+  init_sem(&sems[0], 0);
+  init_sem(&sems[1], 0);
+  start = now_ns();
+  if (fork() == 0)
+  {
+    for (i = 0; i < iters; i++)
+    {
+      if (fast)
+      {
+        down(&sems[0]);
+        up(&sems[1]);
+      } else
+      {
+        cs1550_down(&sems[0]);
+        cs1550_up(&sems[1]);
+      }
+    }
+    exit(0);
+  }
+  for (i = 0; i < iters; i++)
+  {
+    if (fast)
+    {
+      up(&sems[0]);
+      down(&sems[1]);
+    } else
+    {
+      cs1550_up(&sems[0]);
+      cs1550_down(&sems[1]);
+    }
+  }
+  wait(NULL);
+  return (now_ns() - start) / iters;
+}
+
+//same round trip with each side's up and down merged into one cs1550_up_down() call
+static double ping_pong_up_down(struct cs1550_sem* sems, int iters)
+{
+  double start;
+  int i;
+
+  init_sem(&sems[0], 0);
+  init_sem(&sems[1], 0);
+  start = now_ns();
+  if (fork() == 0)
+  {
+    cs1550_down(&sems[0]);
+    for (i = 1; i < iters; i++)
+    {
+      up_down(&sems[1], &sems[0]);
+    }
+    cs1550_up(&sems[1]);
+    exit(0);
+  }
+  for (i = 0; i < iters; i++)
+  {
+    up_down(&sems[0], &sems[1]);
+  }
+  wait(NULL);
+  return (now_ns() - start) / iters;
+}
+
+//two new handles with count 0, or -1 with neither left behind if the kernel refused
+static int create_pair(int* a, int* b)
+{
+  *a = cs1550_create(0);
+  *b = *a < 0 ? -1 : cs1550_create(0);
+  if (*b < 0)
+  {
+    perror("cs1550_create");
+    if (*a >= 0)
+    {
+      cs1550_destroy(*a);
+    }
+    return -1;
+  }
+  return 0;
+}
+
+//same round trip on kernel-managed semaphores named by handle, -1 if none could be made
+static double ping_pong_handles(int iters)
+{
+  int a, b;
+  double start, ns;
+  int i;
+
+  if (create_pair(&a, &b) != 0)
+  {
+    return -1;
+  }
+  start = now_ns();
+  if (fork() == 0)
+  {
+    for (i = 0; i < iters; i++)
+    {
+      cs1550_down_handle(a);
+      cs1550_up_handle(b);
+    }
+    exit(0);
+  }
+  for (i = 0; i < iters; i++)
+  {
+    cs1550_up_handle(a);
+    cs1550_down_handle(b);
+  }
+  wait(NULL);
+  ns = (now_ns() - start) / iters;
+  cs1550_destroy(a);
+  cs1550_destroy(b);
+  return ns;
+}
+
+//handle round trip where the child waits in poll() on a semaphore fd before reading it
+static double ping_pong_poll(int iters)
+{
+  int a, b;
+  double start, ns;
+  int i;
+
+  if (create_pair(&a, &b) != 0)
+  {
+    return -1;
+  }
+  start = now_ns();
+  if (fork() == 0)
+  {
+    struct pollfd pfd;
+    int unit;
+
+    pfd.fd = cs1550_sem_fd(a);
+    pfd.events = POLLIN;
+    for (i = 0; i < iters; i++)
+    {
+      poll(&pfd, 1, -1);
+      read(pfd.fd, &unit, sizeof(unit));
+      cs1550_up_handle(b);
+    }
+    close(pfd.fd);
+    exit(0);
+  }
+  for (i = 0; i < iters; i++)
+  {
+    cs1550_up_handle(a);
+    cs1550_down_handle(b);
+  }
+  wait(NULL);
+  ns = (now_ns() - start) / iters;
+  cs1550_destroy(a);
+  cs1550_destroy(b);
+  return ns;
+}
+
+//ns per mutex hold with two processes contending for a short critical section
+static double short_holds(struct cs1550_sem* sem, int iters)
+{
+  double start;
+  int p, i;
+  volatile int work;
+
+  init_sem(sem, 1);
+  start = now_ns();
+  for (p = 0; p < 2; p++)
+  {
+    if (fork() == 0)
+    {
+      for (i = 0; i < iters; i++)
+      {
+        down(sem);
+        for (work = 0; work < HOLD_WORK; work++);
+        up(sem);
+      }
+      exit(0);
+    }
+  }
+  while (wait(NULL) > 0);
+  return (now_ns() - start) / (2.0 * iters);
+}
+
+static void report(const char* name, double ns, long before, int ops)
+{
+  if (ns < 0)
+  {
+    printf("%-34s skipped\n", name);
+    return;
+  }
+  printf("%-34s %8.1f ns %8.3f switches/op\n", name, ns, (double)(switches() - before) / ops);
+}
+
+int main(int argc, char** argv)
+{
+  int iters = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERS;
+  //shared so the ping-pong child sees the same semaphores
+  struct cs1550_sem* sems = (struct cs1550_sem*)mmap(NULL, sizeof(struct cs1550_sem) * 2,
+  PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, 0, 0);
+  long before;
+  double ns;
+
+  before = switches();
+  ns = uncontended(sems, iters, 0);
+  report("uncontended down+up, syscall:", ns, before, iters);
+  before = switches();
+  ns = uncontended(sems, iters, 1);
+  report("uncontended down+up, fast path:", ns, before, iters);
+  before = switches();
+  ns = ping_pong(sems, iters / 10, 0);
+  report("ping-pong round trip, syscall:", ns, before, iters / 10);
+  before = switches();
+  ns = ping_pong(sems, iters / 10, 1);
+  report("ping-pong round trip, fast path:", ns, before, iters / 10);
+  before = switches();
+  ns = ping_pong_up_down(sems, iters / 10);
+  report("ping-pong round trip, up_down:", ns, before, iters / 10);
+  before = switches();
+  ns = ping_pong_handles(iters / 10);
+  report("ping-pong round trip, handles:", ns, before, iters / 10);
+  before = switches();
+  ns = ping_pong_poll(iters / 10);
+  report("ping-pong round trip, poll fd:", ns, before, iters / 10);
+  before = switches();
+  ns = short_holds(sems, iters / 10);
+  report("contended short hold, fast path:", ns, before, 2 * (iters / 10));
+  return 0;
+}
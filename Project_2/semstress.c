@@ -0,0 +1,104 @@
+/*
+ *  CS 1550 Project 2: Producer/Consumer Problem
+ *  Stress benchmark for many independent cs1550 semaphore pairs
+ *  Author: Michael Korst (mpk44@pitt.edu)
+ *
+ *  Usage: semstress [max_pairs] [round_trips]
+ *  For 1, 2, 4, ... max_pairs pairs of processes, each pair ping-pongs on its own two
+ *  semaphores and the total round trips per second are reported. With independent
+ *  locks per semaphore the total should grow with pairs until the cores run out.
+ */
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "cs1550.h"
+
+#define DEFAULT_PAIRS 16
+#define DEFAULT_TRIPS 100000
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//ping ups its partner and waits to be upped back, pong does the reverse
+static void run_side(struct cs1550_sem* mine, struct cs1550_sem* theirs, int trips, int ping)
+{
+  int i;
+  for (i = 0; i < trips; i++)
+  {
+    //raw syscalls, this measures the kernel side
+    if (ping)
+    {
+      cs1550_up(theirs);
+      cs1550_down(mine);
+    } else
+    {
+      cs1550_down(mine);
+      cs1550_up(theirs);
+    }
+  }
+}
+
+static double run_pairs(int pairs, int trips)
+{
+  struct cs1550_sem* sems;
+  double start, elapsed;
+  int i;
+
+  //two semaphores per pair, shared with every child at the same address
+  sems = (struct cs1550_sem*)mmap(NULL, sizeof(struct cs1550_sem) * 2 * pairs,
+  PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, 0, 0);
+  for (i = 0; i < 2 * pairs; i++)
+  {
+    sems[i].value = 0;
+    sems[i].flags = 0;
+  }
+
+  start = now_sec();
+  for (i = 0; i < 2 * pairs; i++)
+  {
+    if (fork() == 0)
+    {
+      struct cs1550_sem* a = &sems[(i / 2) * 2];
+      struct cs1550_sem* b = a + 1;
+      if (i % 2 == 0)
+      {
+        run_side(a, b, trips, 1);
+      } else
+      {
+        run_side(b, a, trips, 0);
+      }
+      exit(0);
+    }
+  }
+  while (wait(NULL) > 0);
+  elapsed = now_sec() - start;
+
+  munmap(sems, sizeof(struct cs1550_sem) * 2 * pairs);
+  return elapsed;
+}
+
+int main(int argc, char** argv)
+{
+  int max_pairs = argc > 1 ? atoi(argv[1]) : DEFAULT_PAIRS;
+  int trips = argc > 2 ? atoi(argv[2]) : DEFAULT_TRIPS;
+  int pairs;
+  double elapsed;
+
+  printf("%-8s %-12s %-16s\n", "pairs", "seconds", "round trips/s");
+  for (pairs = 1; pairs <= max_pairs; pairs *= 2)
+  {
+    elapsed = run_pairs(pairs, trips);
+    printf("%-8d %-12.3f %-16.0f\n", pairs, elapsed, (double)pairs * trips / elapsed);
+  }
+  return 0;
+}
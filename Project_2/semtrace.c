@@ -0,0 +1,327 @@
+/*
+ *  CS 1550 Project 2: Producer/Consumer Problem
+ *  Wait and wakeup latency histograms from the cs1550 trace
+ *  Author: Michael Korst (mpk44@pitt.edu)
+ *
+ *  Usage: semtrace [seconds]
+ *         semtrace -f trace_file
+ *  Turns tracing on through /proc/cs1550_trace (root only), collects events for the
+ *  given number of seconds, turns it off again, and prints three histograms for every
+ *  semaphore seen:
+ *    lock:   ns down and up spun on the semaphore's kernel lock, when 1000 or more
+ *    queued: ns from joining the wait queue until an up handed over a unit
+ *    wakeup: ns from that up's wake_up_process() until the sleeper ran again
+ *  A stall with big lock times is contention on the lock itself, big queued times mean
+ *  the producers or consumers really are behind, big wakeup times mean the scheduler
+ *  is slow to run whoever was woken. With -f, events saved earlier are read instead,
+ *  from cat of /proc/cs1550_trace while tracing or from cs1550bench -T. Events the kernel
+ *  overwrote before they were read are counted in /proc/cs1550_sem and reported, the
+ *  queued and wakeup samples of those waiters are missing.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cs1550.h"
+
+#define TRACE_PROC "/proc/cs1550_trace"
+#define STATS_PROC "/proc/cs1550_sem"
+#define DEFAULT_SECONDS 5
+#define POLL_NS 10000000        //read the rings this often, they only hold about a thousand events
+#define MAX_SEMS 64             //semaphores with their own histograms, the rest are counted
+#define PID_SLOTS 32768         //default pid_max, waiters are tracked by pid
+#define HIST_SLOTS 64           //power of two buckets of ns
+
+struct hist
+{
+  unsigned long long slots[HIST_SLOTS];
+  unsigned long long count;
+};
+
+struct sem_hists
+{
+  unsigned long long sem;
+  struct hist lock;
+  struct hist queued;
+  struct hist wakeup;
+};
+
+//where each sleeping task is between enqueue and resume
+struct waiter
+{
+  unsigned long long sem;
+  unsigned long long enqueued;   //0 if not queued
+  unsigned long long woken;      //0 until an up wakes it
+};
+
+static struct cs1550_trace_event* events;
+static size_t nevents, capacity;
+static struct sem_hists sems[MAX_SEMS];
+static int nsems;
+static unsigned long long untracked;
+static struct waiter waiters[PID_SLOTS];
+
+static void add_events(const struct cs1550_trace_event* ev, size_t n)
+{
+  if (nevents + n > capacity)
+  {
+    capacity = (nevents + n) * 2;
+    events = (struct cs1550_trace_event*)realloc(events, capacity * sizeof(*events));
+  }
+  memcpy(events + nevents, ev, n * sizeof(*ev));
+  nevents += n;
+}
+
+//whole events from in until it has nothing more right now
+static void read_events(FILE* in)
+{
+  struct cs1550_trace_event buf[128];
+  size_t n;
+
+  while ((n = fread(buf, sizeof(buf[0]), 128, in)) > 0)
+  {
+    add_events(buf, n);
+  }
+  clearerr(in);
+}
+
+static int set_tracing(const char* on)
+{
+  FILE* ctl = fopen(TRACE_PROC, "w");
+
+  if (ctl == NULL)
+  {
+    perror(TRACE_PROC);
+    return -1;
+  }
+  fputs(on, ctl);
+  return fclose(ctl);
+}
+
+//events the kernel overwrote since tracing was switched on, -1 if it does not say
+static long long read_dropped(void)
+{
+  FILE* in = fopen(STATS_PROC, "r");
+  char line[256];
+  char state[8];
+  long long dropped = -1;
+
+  if (in == NULL)
+  {
+    return -1;
+  }
+  while (fgets(line, sizeof(line), in) != NULL)
+  {
+    if (sscanf(line, "tracing %7[^,], %lld events dropped", state, &dropped) == 2)
+    {
+      break;
+    }
+  }
+  fclose(in);
+  return dropped;
+}
+
+static int collect(int seconds)
+{
+  struct timespec nap = { 0, POLL_NS };
+  long naps = (long)seconds * (1000000000 / POLL_NS);
+  FILE* in;
+
+  if (set_tracing("1") != 0)
+  {
+    return -1;
+  }
+  in = fopen(TRACE_PROC, "r");
+  if (in == NULL)
+  {
+    perror(TRACE_PROC);
+    set_tracing("0");
+    return -1;
+  }
+  setvbuf(in, NULL, _IONBF, 0);          //a buffered read could leave half an event behind
+  while (naps-- > 0)
+  {
+    read_events(in);
+    nanosleep(&nap, NULL);
+  }
+  set_tracing("0");
+  read_events(in);
+  fclose(in);
+  return 0;
+}
+
+static int cmp_events(const void* a, const void* b)
+{
+  const struct cs1550_trace_event* x = (const struct cs1550_trace_event*)a;
+  const struct cs1550_trace_event* y = (const struct cs1550_trace_event*)b;
+  return x->ns < y->ns ? -1 : x->ns > y->ns;
+}
+
+static struct sem_hists* hists_for(unsigned long long sem)
+{
+  int i;
+
+  for (i = 0; i < nsems; i++)
+  {
+    if (sems[i].sem == sem)
+    {
+      return &sems[i];
+    }
+  }
+  if (nsems == MAX_SEMS)
+  {
+    untracked++;
+    return NULL;
+  }
+  sems[nsems].sem = sem;
+  return &sems[nsems++];
+}
+
+static void hist_add(struct hist* h, unsigned long long ns)
+{
+  int slot = 0;
+
+  while (ns > 1 && slot < HIST_SLOTS - 1)
+  {
+    ns >>= 1;
+    slot++;
+  }
+  h->slots[slot]++;
+  h->count++;
+}
+
+//follow each task from enqueue through wake to resume, the rings are per CPU so the
+//events are put in time order first
+static void analyze()
+{
+  size_t i;
+
+  qsort(events, nevents, sizeof(events[0]), cmp_events);
+  for (i = 0; i < nevents; i++)
+  {
+    struct cs1550_trace_event* ev = &events[i];
+    struct waiter* w = &waiters[ev->pid % PID_SLOTS];
+    struct sem_hists* h = hists_for(ev->sem);
+
+    if (h == NULL)
+    {
+      continue;
+    }
+    switch (ev->type)
+    {
+      case CS1550_TRACE_LOCK:
+        hist_add(&h->lock, ev->arg);
+        break;
+      case CS1550_TRACE_ENQUEUE:
+        w->sem = ev->sem;
+        w->enqueued = ev->ns;
+        w->woken = 0;
+        break;
+      case CS1550_TRACE_WAKE:
+        //the enqueue may have been before tracing started or lost to a full ring
+        if (w->enqueued != 0 && w->sem == ev->sem)
+        {
+          hist_add(&h->queued, ev->ns - w->enqueued);
+        }
+        w->sem = ev->sem;
+        w->woken = ev->ns;
+        break;
+      case CS1550_TRACE_RESUME:
+        if (w->woken != 0 && w->sem == ev->sem)
+        {
+          hist_add(&h->wakeup, ev->ns - w->woken);
+        }
+        w->enqueued = 0;
+        w->woken = 0;
+        break;
+      case CS1550_TRACE_ABORT:
+        w->enqueued = 0;
+        w->woken = 0;
+        break;
+    }
+  }
+}
+
+static void print_hist(const char* name, struct hist* h)
+{
+  unsigned long long most = 0;
+  int lo = HIST_SLOTS, hi = -1;
+  int i, j;
+
+  if (h->count == 0)
+  {
+    return;
+  }
+  for (i = 0; i < HIST_SLOTS; i++)
+  {
+    if (h->slots[i] != 0)
+    {
+      lo = i < lo ? i : lo;
+      hi = i;
+      most = h->slots[i] > most ? h->slots[i] : most;
+    }
+  }
+  printf("  %s ns, %llu samples\n", name, h->count);
+  for (i = lo; i <= hi; i++)
+  {
+    int stars = (int)(h->slots[i] * 40 / most);
+
+    printf("  %12llu -> %-12llu : %-10llu |", i == 0 ? 0ULL : 1ULL << i, (2ULL << i) - 1, h->slots[i]);
+    for (j = 0; j < 40; j++)
+    {
+      putchar(j < stars ? '*' : ' ');
+    }
+    printf("|\n");
+  }
+}
+
+int main(int argc, char** argv)
+{
+  long long dropped = -1;
+  int i;
+
+  if (argc == 3 && strcmp(argv[1], "-f") == 0)
+  {
+    FILE* in = fopen(argv[2], "rb");
+    if (in == NULL)
+    {
+      perror(argv[2]);
+      return 1;
+    }
+    read_events(in);
+    fclose(in);
+  } else if (argc <= 2 && (argc == 1 || argv[1][0] != '-'))
+  {
+    if (collect(argc > 1 ? atoi(argv[1]) : DEFAULT_SECONDS) != 0)
+    {
+      return 1;
+    }
+    dropped = read_dropped();
+  } else
+  {
+    fprintf(stderr, "Usage: %s [seconds] | %s -f trace_file\n", argv[0], argv[0]);
+    return 1;
+  }
+
+  analyze();
+  printf("%lu events, %d semaphores\n", (unsigned long)nevents, nsems);
+  if (dropped > 0)
+  {
+    printf("%lld events dropped before they were read, some waiters are missing\n", dropped);
+  }
+  for (i = 0; i < nsems; i++)
+  {
+    printf("semaphore 0x%llx\n", sems[i].sem);
+    print_hist("lock", &sems[i].lock);
+    print_hist("queued", &sems[i].queued);
+    print_hist("wakeup", &sems[i].wakeup);
+  }
+  if (untracked > 0)
+  {
+    printf("%llu events on semaphores past the first %d not shown\n", untracked, MAX_SEMS);
+  }
+  return 0;
+}
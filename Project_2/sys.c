@@ -33,6 +33,14 @@
 #include <linux/task_io_accounting_ops.h>
 #include <linux/seccomp.h>
 #include <linux/cpu.h>
+#include <linux/hash.h>
+#include <linux/futex.h>
+#include <linux/hrtimer.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/anon_inodes.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
 
 #include <linux/compat.h>
 #include <linux/syscalls.h>
@@ -2360,88 +2368,2252 @@ EXPORT_SYMBOL_GPL(orderly_poweroff);
 
 //Begin CS1550 Project 2 Code
 
-DEFINE_SPINLOCK(sem_lock);						//spin lock for atomicity
+#define CS1550_LOCK_BITS 6
+#define CS1550_LOCK_BUCKETS (1 << CS1550_LOCK_BITS)		//semaphores are hashed over this many locks
 
-//node struct for linked list process queue
-struct proc_node
+#define CS1550_SLOTS_PER_BUCKET 4		//semaphores per bucket the kernel keeps a record of
+#define CS1550_SLOT_IDLE HZ				//unused this long before a record goes to another semaphore
+
+//contention counters, kept per semaphore, per CPU, and handed to user space by cs1550_stats()
+struct cs1550_stats
+{
+	u64 acquisitions;				//units handed out by the kernel
+	u64 blocked;					//downs that had to sleep
+	u64 spun;						//downs satisfied by spinning, global only
+	u64 aborted;					//sleeps cut short by a timeout or signal
+	u64 ups;						//units released through the kernel
+	u64 wait_ns;					//total time spent asleep
+	u64 max_wait_ns;				//longest single sleep
+	s64 depth;						//tasks queued right now
+};
+
+//kernel record of one semaphore, guarded by the bucket lock of that semaphore
+//the key holds no reference, a record that outlives its semaphore just ages out
+struct cs1550_sem_slot
+{
+	union futex_key key;			//what backs the semaphore, as in cs1550_semref
+	int in_use;
+	unsigned long last_used;		//jiffies when a task last went through the kernel with it
+	pid_t owner;					//last task to get a unit through the kernel, a hint for spinning
+	struct task_struct* boosted;	//CS1550_SEM_PI holder running at a waiter's nice, holds a reference
+	int orig_nice;					//nice value boosted goes back to
+	struct cs1550_stats stats;
+};
+
+//one lock per bucket, each on its own cache line so independent semaphores never share one
+struct cs1550_bucket
+{
+	spinlock_t lock;
+	struct list_head waiters;		//tasks asleep on anything hashed here, FIFO per object
+	struct cs1550_sem_slot slots[CS1550_SLOTS_PER_BUCKET];
+} ____cacheline_aligned_in_smp;
+
+static struct cs1550_bucket sem_buckets[CS1550_LOCK_BUCKETS] = {
+	[0 ... CS1550_LOCK_BUCKETS - 1] = { .lock = __SPIN_LOCK_UNLOCKED(sem_buckets.lock) }
+};
+
+//sleeper in a bucket's waiters list, lives on its kernel stack
+struct cs1550_waiter
 {
-	struct proc_node* next;			//next process in linked list
-	struct task_struct* proc_info;		//info about this process
+	struct list_head list;
+	union futex_key key;			//object waited on, tells apart waiters sharing a bucket
+	struct task_struct* task;
+	int nice;						//nice value when it queued, for CS1550_SEM_PRIO
+	int write;						//rwsem waiter wants the write side
+	unsigned int target;			//eventcount value an awaiter is waiting for
+	int woken;						//set under the lock once what we waited for is ours
 };
 
-//circularly linked list for easy addition and removal to process queue
+//semaphore in user memory, its sleepers are kept in the kernel in the bucket of its key
+//so nothing user space can write is ever followed as a pointer
 struct cs1550_sem
 {
 	int value;
-	struct proc_node* head;					//start of process queue
-	struct proc_node* tail;					//end of process queue
+	int flags;								//CS1550_SEM_ options below, set by the user before first use
 };
 
-asmlinkage long sys_cs1550_down(struct cs1550_sem* sem)
+#define CS1550_SEM_PRIO 0x1		//wake waiters by nice value, FIFO among equal values
+#define CS1550_SEM_PI 0x2			//used as a mutex, holder inherits the nice value of its best waiter
+
+#define CS1550_SEMOP_MAX 8			//most semaphores one cs1550_semop() call may touch
+
+//one operation in a cs1550_semop() batch
+struct cs1550_sembuf
 {
-	spin_lock(&sem_lock);					//entering critical region
+	struct cs1550_sem* sem;
+	int delta;						//-1 to down, positive to up by that much
+};
 
-	sem->value--;								//decrement semaphore counter
+//A semaphore is found by what backs its address, the way futexes are: a word in a shared
+//mapping by its file page and offset, so processes that map it at different addresses
+//still agree on the lock, and a word in private memory by the mm and address, so a fork
+//child's copy-on-write copy is a semaphore of its own.
 
-	//out of resources, time to block
-	if (sem->value < 0)
+//one semaphore for the length of a syscall
+struct cs1550_semref
+{
+	struct cs1550_sem* sem;			//user address in the calling process
+	union futex_key key;			//what backs it, holds a reference until sem_put()
+	struct cs1550_bucket* bucket;	//lock and waiters for the key
+};
+
+//key for the int at uaddr, -EFAULT if it is not mapped and -EINVAL if it is misaligned
+//holds a reference on the inode or mm behind it, dropped by cs1550_put_key()
+static long cs1550_get_key(void __user* uaddr, union futex_key* key)
+{
+	struct rw_semaphore* mmap_sem = &current->mm->mmap_sem;
+	long ret;
+
+	down_read(mmap_sem);
+	ret = get_futex_key((u32 __user*)uaddr, mmap_sem, key);
+	if (ret == 0)
+	{
+		get_futex_key_refs(key);
+	}
+	up_read(mmap_sem);
+	return ret;
+}
+
+//may sleep on the last reference, so never under a bucket lock
+static void cs1550_put_key(union futex_key* key)
+{
+	drop_futex_key_refs(key);
+}
+
+static int cs1550_key_match(union futex_key* a, union futex_key* b)
+{
+	return a->both.word == b->both.word && a->both.ptr == b->both.ptr &&
+		a->both.offset == b->both.offset;
+}
+
+static int key_bucket_index(union futex_key* key)
+{
+	return hash_long(key->both.word + (unsigned long)key->both.ptr + key->both.offset,
+		CS1550_LOCK_BITS);
+}
+
+//fill in ref for the semaphore at sem, undone with sem_put()
+static long sem_get(struct cs1550_semref* ref, struct cs1550_sem* sem)
+{
+	long ret = cs1550_get_key(sem, &ref->key);
+
+	if (ret)
+	{
+		return ret;
+	}
+	ref->sem = sem;
+	ref->bucket = &sem_buckets[key_bucket_index(&ref->key)];
+	return 0;
+}
+
+static void sem_put(struct cs1550_semref* ref)
+{
+	cs1550_put_key(&ref->key);
+}
+
+//hand the object to waiter and wake it, caller holds the bucket lock
+static void waiter_grant(struct cs1550_waiter* waiter)
+{
+	list_del(&waiter->list);
+	waiter->woken = 1;
+	wake_up_process(waiter->task);
+}
+
+//global counters, each CPU adds to its own copy and readers sum them
+static DEFINE_PER_CPU(struct cs1550_stats, cs1550_cpu_stats);
+
+#define cs1550_count(field, n) \
+	do { get_cpu_var(cs1550_cpu_stats).field += (n); put_cpu_var(cs1550_cpu_stats); } while (0)
+
+//counts of semaphores whose record went to another semaphore, per CPU like the totals
+static DEFINE_PER_CPU(struct cs1550_stats, cs1550_evicted_stats);
+
+//add the counters in from to those in into, max_wait_ns is the larger of the two
+static void cs1550_stats_add(struct cs1550_stats* into, struct cs1550_stats* from)
+{
+	into->acquisitions += from->acquisitions;
+	into->blocked += from->blocked;
+	into->spun += from->spun;
+	into->aborted += from->aborted;
+	into->ups += from->ups;
+	into->wait_ns += from->wait_ns;
+	into->depth += from->depth;
+	if (from->max_wait_ns > into->max_wait_ns)
+	{
+		into->max_wait_ns = from->max_wait_ns;
+	}
+}
+
+//Tracing: while switched on through /proc/cs1550_trace, down and up log when a task spins
+//on the bucket lock for CS1550_TRACE_LOCK_NS or longer, joins the wait queue, is handed a
+//unit and woken, and gets back on a CPU. Events go to a ring per CPU and read() of the
+//file drains them, so a tool can tell time in the queue from time waiting for the
+//scheduler. Off by default, costs one test per event site while off.
+
+#define CS1550_TRACE_LOCK 0			//down or up spun on the bucket lock, arg is ns spent spinning
+#define CS1550_TRACE_ENQUEUE 1		//task went on the wait queue
+#define CS1550_TRACE_WAKE 2			//up gave a unit to pid and woke it
+#define CS1550_TRACE_RESUME 3		//pid is running again after being woken, before relocking
+#define CS1550_TRACE_ABORT 4		//pid left the queue on a timeout or signal
+
+#define CS1550_TRACE_EVENTS 1024	//per CPU, the oldest are overwritten if nobody reads
+#define CS1550_TRACE_LOCK_NS 1000	//shorter spins are not logged, or every op would fill the ring
+
+//one record as read() hands it out, the same layout on 32 and 64 bit
+struct cs1550_trace_event
+{
+	u64 ns;							//ktime_get() when it happened
+	u64 sem;						//user address of the semaphore
+	u64 arg;
+	u32 pid;						//task the event is about, the woken one for a wake
+	u32 type;						//CS1550_TRACE_ above
+};
+
+struct cs1550_trace_ring
+{
+	spinlock_t lock;				//against the reader, the writer is always this CPU
+	unsigned int head;				//next slot written
+	unsigned int count;				//events not read yet
+	u64 dropped;					//overwritten before anyone read them
+	struct cs1550_trace_event events[CS1550_TRACE_EVENTS];
+};
+
+static DEFINE_PER_CPU(struct cs1550_trace_ring, cs1550_trace_rings);
+static int cs1550_tracing;
+
+static void cs1550_trace_at(int type, struct cs1550_sem* sem, pid_t pid, ktime_t when, u64 arg)
+{
+	struct cs1550_trace_ring* ring = &get_cpu_var(cs1550_trace_rings);
+	struct cs1550_trace_event* ev;
+
+	spin_lock(&ring->lock);
+	ev = &ring->events[ring->head];
+	ev->ns = ktime_to_ns(when);
+	ev->sem = (unsigned long)sem;
+	ev->arg = arg;
+	ev->pid = pid;
+	ev->type = type;
+	ring->head = (ring->head + 1) % CS1550_TRACE_EVENTS;
+	if (ring->count == CS1550_TRACE_EVENTS)
+	{
+		ring->dropped++;
+	} else
+	{
+		ring->count++;
+	}
+	spin_unlock(&ring->lock);
+	put_cpu_var(cs1550_trace_rings);
+}
+
+#define cs1550_trace(type, sem, pid, arg) \
+	do { if (unlikely(cs1550_tracing)) cs1550_trace_at(type, sem, pid, ktime_get(), arg); } while (0)
+
+//spin_lock() on the semaphore's bucket, logging how long it spun while tracing is on
+//if that was long enough to be contention
+static void sem_lock_traced(struct cs1550_semref* ref)
+{
+	ktime_t start;
+	s64 spun;
+
+	if (likely(!cs1550_tracing))
+	{
+		spin_lock(&ref->bucket->lock);
+		return;
+	}
+	start = ktime_get();
+	spin_lock(&ref->bucket->lock);
+	spun = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (spun >= CS1550_TRACE_LOCK_NS)
+	{
+		cs1550_trace(CS1550_TRACE_LOCK, ref->sem, current->pid, spun);
+	}
+}
+
+//record for the semaphore, claiming one if needed, NULL if the bucket has none to spare
+//a full bucket gives up the least used record idle for CS1550_SLOT_IDLE and not holding
+//a boost, so a few more active semaphores than slots do not keep resetting each other's
+//counts, and what the old owner had counted moves to the evicted totals instead of being
+//lost
+//caller holds the bucket lock
+static struct cs1550_sem_slot* sem_slot_for(struct cs1550_semref* ref)
+{
+	struct cs1550_sem_slot* slots = ref->bucket->slots;
+	struct cs1550_sem_slot* victim = NULL;
+	int i;
+
+	for (i = 0; i < CS1550_SLOTS_PER_BUCKET; i++)
+	{
+		if (slots[i].in_use && cs1550_key_match(&slots[i].key, &ref->key))
+		{
+			slots[i].last_used = jiffies;
+			return &slots[i];
+		}
+	}
+	for (i = 0; i < CS1550_SLOTS_PER_BUCKET; i++)
+	{
+		if (!slots[i].in_use)
+		{
+			victim = &slots[i];
+			break;
+		}
+		if (slots[i].stats.depth == 0 && slots[i].boosted == NULL &&
+			time_after(jiffies, slots[i].last_used + CS1550_SLOT_IDLE) &&
+			(victim == NULL || slots[i].stats.acquisitions < victim->stats.acquisitions))
+		{
+			victim = &slots[i];
+		}
+	}
+	if (victim == NULL)
+	{
+		return NULL;
+	}
+	if (victim->in_use)
+	{
+		cs1550_stats_add(&__get_cpu_var(cs1550_evicted_stats), &victim->stats);	//bucket lock keeps preemption off
+	}
+	memset(victim, 0, sizeof(*victim));
+	victim->key = ref->key;
+	victim->in_use = 1;
+	victim->last_used = jiffies;
+	return victim;
+}
+
+//value as an atomic_t, int and atomic_t share a layout
+static atomic_t* sem_value(struct cs1550_sem* sem)
+{
+	return (atomic_t*)&sem->value;
+}
+
+//put waiter in its bucket's list, caller holds the lock
+//FIFO by default, a CS1550_SEM_PRIO waiter goes in front of the first waiter on the same
+//semaphore that is less important, so among themselves they stay sorted by nice value
+static void sem_enqueue(struct cs1550_semref* ref, struct cs1550_waiter* waiter)
+{
+	struct cs1550_waiter* w;
+
+	if (ref->sem->flags & CS1550_SEM_PRIO)
+	{
+		list_for_each_entry(w, &ref->bucket->waiters, list)
+		{
+			if (w->nice > waiter->nice && cs1550_key_match(&w->key, &ref->key))
+			{
+				list_add_tail(&waiter->list, &w->list);
+				return;
+			}
+		}
+	}
+	list_add_tail(&waiter->list, &ref->bucket->waiters);
+}
+
+//a waiter may lend its nice value to the holder only if setpriority() would have let it
+//set that value there itself, even a thread of its own process, so RLIMIT_NICE still holds
+static int sem_may_boost(struct task_struct* owner, int nice)
+{
+	if (owner->uid != current->euid && owner->euid != current->euid && !capable(CAP_SYS_NICE))
+	{
+		return 0;
+	}
+	return can_nice(owner, nice);
+}
+
+//give a boosted holder its own nice value back, caller holds the bucket lock
+static void sem_unboost(struct cs1550_sem_slot* slot)
+{
+	if (slot->boosted != NULL)
+	{
+		set_user_nice(slot->boosted, slot->orig_nice);
+		put_task_struct(slot->boosted);
+		slot->boosted = NULL;
+	}
+}
+
+//raise the holder of a CS1550_SEM_PI semaphore to nice, remembering where it started,
+//so a batch job holding the mutex cannot keep a more important waiter asleep
+//the holder is whoever the kernel last gave a unit to, never anything user space wrote
+//caller holds the bucket lock
+static void sem_boost_owner(struct cs1550_semref* ref, int nice)
+{
+	struct cs1550_sem_slot* slot = sem_slot_for(ref);
+	struct task_struct* owner;
+
+	if (slot == NULL || slot->owner == 0)
+	{
+		return;
+	}
+	rcu_read_lock();
+	owner = find_task_by_pid(slot->owner);
+	if (owner != NULL && owner != current && task_nice(owner) > nice && sem_may_boost(owner, nice))
 	{
-		//allocate memory to track blocking process
-		struct proc_node* curr_process = (struct proc_node*)kmalloc(sizeof(struct proc_node), GFP_ATOMIC);
-		curr_process->next = NULL;				//new process end of linked list
-		curr_process->proc_info = current;					//use global variable to get running process info
+		if (slot->boosted != owner)
+		{
+			sem_unboost(slot);				//a holder before this one, it has let go
+			get_task_struct(owner);
+			slot->boosted = owner;
+			slot->orig_nice = task_nice(owner);
+		}
+		set_user_nice(owner, nice);
+	}
+	rcu_read_unlock();
+}
+
+//after a waiter left without a unit, keep the holder's boost at what the waiters still
+//queued need, or give it its own nice value back if none of them needs one
+//caller holds the bucket lock
+static void sem_reboost(struct cs1550_semref* ref)
+{
+	struct cs1550_sem_slot* slot = sem_slot_for(ref);
+	struct cs1550_waiter* w;
+	int nice = 20;							//weaker than any nice value
 
-		if (sem->head == NULL)
+	if (slot == NULL || slot->boosted == NULL)
+	{
+		return;
+	}
+	list_for_each_entry(w, &ref->bucket->waiters, list)
+	{
+		if (cs1550_key_match(&w->key, &ref->key) && w->nice < nice)
 		{
-			//empty linked list
-			sem->head = curr_process;					//start linked list
-			sem->tail = curr_process;
-		} else {
-			//linked list not empty, add to end
-			sem->tail->next = curr_process;
-			sem->tail = curr_process;
+			nice = w->nice;
 		}
-		//put process to sleep, while allowing interrurpt
+	}
+	if (nice >= slot->orig_nice)
+	{
+		sem_unboost(slot);
+	} else
+	{
+		set_user_nice(slot->boosted, nice);
+	}
+}
+
+//put the caller in the bucket as a sleeper on the semaphore, caller holds the lock and has
+//already taken its unit from the count
+static void sem_queue(struct cs1550_semref* ref, struct cs1550_waiter* waiter)
+{
+	struct cs1550_sem* sem = ref->sem;
+
+	waiter->key = ref->key;
+	waiter->task = current;
+	waiter->woken = 0;
+	waiter->nice = task_nice(current);
+	sem_enqueue(ref, waiter);
+	cs1550_trace(CS1550_TRACE_ENQUEUE, sem, current->pid, 0);
+	if (sem->flags & CS1550_SEM_PI)
+	{
+		sem_boost_owner(ref, waiter->nice);
+	}
+}
+
+//undo sem_queue() for a waiter that gives up: off the list, its unit back in the count,
+//and no more boost for the holder than the remaining waiters need
+static void sem_unqueue(struct cs1550_semref* ref, struct cs1550_waiter* waiter)
+{
+	list_del(&waiter->list);
+	atomic_inc(sem_value(ref->sem));
+	if (ref->sem->flags & CS1550_SEM_PI)
+	{
+		sem_reboost(ref);
+	}
+}
+
+//sleep, waiter already queued by sem_queue(), until up() hands over the resource,
+//returns -EINTR if a signal arrives first or -ETIMEDOUT if timeout (already started,
+//may be NULL) fires first, in either case the waiter is dequeued and the count given back
+//called with the bucket lock held and returns with it held
+static long sem_wait(struct cs1550_semref* ref, struct cs1550_waiter* waiter, struct hrtimer_sleeper* timeout)
+{
+	struct cs1550_sem* sem = ref->sem;
+	spinlock_t* sem_lock = &ref->bucket->lock;
+	struct cs1550_sem_slot* slot = sem_slot_for(ref);
+	struct cs1550_stats* stats = slot != NULL ? &slot->stats : NULL;
+	ktime_t start = ktime_get();
+	ktime_t resumed = start;
+	u64 waited;
+	long ret = 0;
+
+	if (stats != NULL)
+	{
+		stats->depth++;
+	}
+	cs1550_count(depth, 1);
+
+	for (;;)
+	{
+		//put process to sleep, while allowing interrupt
 		set_current_state(TASK_INTERRUPTIBLE);
-		spin_unlock(&sem_lock);						//leaving critical section
+		if (waiter->woken)
+		{
+			break;								//resource is ours even if the timer fired too
+		}
+		if (signal_pending(current))
+		{
+			ret = -EINTR;
+		} else if (timeout != NULL && timeout->task == NULL)
+		{
+			ret = -ETIMEDOUT;					//timer callback clears task when it expires
+		}
+		if (ret)
+		{
+			//waiter is on our stack, it must be off the list before we return
+			sem_unqueue(ref, waiter);
+			cs1550_trace(CS1550_TRACE_ABORT, sem, current->pid, 0);
+			break;
+		}
+		spin_unlock(sem_lock);						//leaving critical section
 		schedule();									//call scheduler to find another process
-	} else {
-		//no need to block, release lock as outside critical section
-		spin_unlock(&sem_lock);
+		if (unlikely(cs1550_tracing))
+		{
+			resumed = ktime_get();					//before the lock, so lock waits are not counted as wakeup latency
+		}
+		spin_lock(sem_lock);
+	}
+	__set_current_state(TASK_RUNNING);
+	if (unlikely(cs1550_tracing) && ret == 0)
+	{
+		cs1550_trace_at(CS1550_TRACE_RESUME, sem, current->pid, resumed, 0);
+	}
+
+	waited = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (stats != NULL)
+	{
+		stats->depth--;
+		stats->blocked++;
+		stats->aborted += ret != 0;
+		stats->wait_ns += waited;
+		if (waited > stats->max_wait_ns)
+		{
+			stats->max_wait_ns = waited;
+		}
+	}
+	cs1550_count(depth, -1);
+	cs1550_count(blocked, 1);
+	cs1550_count(aborted, ret != 0);
+	cs1550_count(wait_ns, waited);
+	if (waited > __get_cpu_var(cs1550_cpu_stats).max_wait_ns)
+	{
+		__get_cpu_var(cs1550_cpu_stats).max_wait_ns = waited;		//bucket lock keeps preemption off
+	}
+	return ret;
+}
+
+//bookkeeping once the caller owns a unit, caller holds the bucket lock
+static void sem_acquired(struct cs1550_semref* ref)
+{
+	struct cs1550_sem_slot* slot = sem_slot_for(ref);
+
+	if (slot != NULL)
+	{
+		slot->owner = current->pid;
+		slot->stats.acquisitions++;
+	}
+	cs1550_count(acquisitions, 1);
+}
+
+//take one unit only if one is free, never queues
+//compare-and-swap because the user-space fast path may take units without the lock
+static int sem_try_take(struct cs1550_sem* sem)
+{
+	int v = atomic_read(sem_value(sem));
+
+	while (v > 0)
+	{
+		int seen = atomic_cmpxchg(sem_value(sem), v, v - 1);
+		if (seen == v)
+		{
+			return 1;
+		}
+		v = seen;
 	}
 	return 0;
 }
 
-asmlinkage long sys_cs1550_up(struct cs1550_sem* sem)
+//how many times down polls a held semaphore before queueing, cs1550_spin= on the boot line
+static int cs1550_spin_limit = 1000;
+
+static int __init cs1550_spin_setup(char* str)
 {
-	spin_lock(&sem_lock);					//entering critical region
+	get_option(&str, &cs1550_spin_limit);
+	return 1;
+}
+__setup("cs1550_spin=", cs1550_spin_setup);
 
-	sem->value++;								//increment semaphore counter
+//true if the task with this pid is on a CPU right now, so it may release soon
+static int sem_owner_running(pid_t pid)
+{
+	struct task_struct* owner;
+	int running = 0;
 
-	//remove process from waiting list
-	if (sem->value <= 0)
+	if (pid <= 0 || pid == current->pid)
+	{
+		return 0;
+	}
+	rcu_read_lock();
+	owner = find_task_by_pid(pid);
+	if (owner != NULL)
 	{
-		struct proc_node* curr_process = sem->head;					//grab process at top of the list, FIFO to avoid starvation
-		struct task_struct* curr_info;											//use for wake up call
+		running = task_curr(owner);
+	}
+	rcu_read_unlock();
+	return running;
+}
 
-		if (curr_process != NULL)
+//poll for a free unit without the lock while the last holder is running elsewhere,
+//a short critical section then costs a few hundred cycles instead of two context switches
+//returns 1 if we got a unit
+static int sem_spin(struct cs1550_semref* ref)
+{
+	struct cs1550_sem* sem = ref->sem;
+	struct cs1550_sem_slot* slot;
+	pid_t owner = 0;
+	int i;
+
+	if (num_online_cpus() < 2 || cs1550_spin_limit <= 0)
+	{
+		return 0;							//holder cannot run while we spin
+	}
+	if (sem_try_take(sem))
+	{
+		return 1;							//free already, no need to know the holder
+	}
+	//the holder is only known to the kernel record, look once rather than on every poll
+	spin_lock(&ref->bucket->lock);
+	slot = sem_slot_for(ref);
+	if (slot != NULL)
+	{
+		owner = slot->owner;
+	}
+	spin_unlock(&ref->bucket->lock);
+	for (i = 0; i < cs1550_spin_limit; i++)
+	{
+		//taking a positive count is safe without the lock, nobody can be queued
+		if (sem_try_take(sem))
+		{
+			return 1;
+		}
+		if (atomic_read(sem_value(sem)) < 0 || need_resched() || !sem_owner_running(owner))
 		{
-			//grab process info
-			curr_info = curr_process->proc_info;
+			break;							//others already queued ahead of us, or holder is off CPU
+		}
+		cpu_relax();
+	}
+	return 0;
+}
 
-			if(curr_process == sem->tail)
-			{
-				//last process in list
-				sem->head = NULL;
-				sem->tail = NULL;
-			} else
-			{
-				sem->head = curr_process->next;
-			}
-			wake_up_process(curr_info);						//wake up sleeping process
+asmlinkage long sys_cs1550_down(struct cs1550_sem* sem)
+{
+	struct cs1550_semref ref;
+	struct cs1550_waiter waiter;				//on our stack, no allocation needed while we sleep
+	long ret = sem_get(&ref, sem);
+
+	if (ret)
+	{
+		return ret;
+	}
+	if (sem_spin(&ref))
+	{
+		sem_lock_traced(&ref);
+		sem_acquired(&ref);					//record the new holder
+		spin_unlock(&ref.bucket->lock);
+		cs1550_count(spun, 1);
+		sem_put(&ref);
+		return 0;
+	}
+
+	sem_lock_traced(&ref);					//entering critical region
+
+	//decrement semaphore counter atomically, the user-space fast path in cs1550.h
+	//updates the same word with compare-and-swap without taking the bucket lock
+	//out of resources, time to block
+	if (atomic_dec_return(sem_value(sem)) < 0)
+	{
+		sem_queue(&ref, &waiter);
+		ret = sem_wait(&ref, &waiter, NULL);
+	}
+	if (ret == 0)
+	{
+		sem_acquired(&ref);
+	}
+	spin_unlock(&ref.bucket->lock);			//leaving critical section
+	sem_put(&ref);
+	return ret;
+}
+
+//hand the resource to the first waiter on the semaphore, caller holds the lock
+//returns 0 if nobody is waiting on it
+static int sem_wake_one(struct cs1550_semref* ref)
+{
+	struct cs1550_waiter* waiter;
+
+	list_for_each_entry(waiter, &ref->bucket->waiters, list)
+	{
+		if (cs1550_key_match(&waiter->key, &ref->key))
+		{
+			//waiter stays valid until we drop the lock, it checks woken under it
+			cs1550_trace(CS1550_TRACE_WAKE, ref->sem, waiter->task->pid, 0);
+			waiter_grant(waiter);
+			return 1;
 		}
-		kfree(curr_process);								//free up space used by process, no longer needed as being executed
 	}
-	spin_unlock(&sem_lock);					//release spinlock, done with critical
 	return 0;
 }
+
+//true if n more units fit in the count, caller holds the lock
+static int sem_room(struct cs1550_semref* ref, int n)
+{
+	return atomic_read(sem_value(ref->sem)) <= INT_MAX - n;
+}
+
+//add n to the count in one step and wake one waiter for each unit that goes to the queue,
+//at most as many as are really asleep, so a huge n costs no more than a small one
+//returns -EOVERFLOW, changing nothing, if the count would pass INT_MAX
+//caller holds the lock
+static long sem_release(struct cs1550_semref* ref, int n)
+{
+	atomic_t* value = sem_value(ref->sem);
+	struct cs1550_sem_slot* slot;
+	int v = atomic_read(value);
+	int seen;
+
+	//compare-and-swap, the fast path in cs1550.h may add to a non-negative count meanwhile
+	for (;;)
+	{
+		if (v > INT_MAX - n)
+		{
+			return -EOVERFLOW;
+		}
+		seen = atomic_cmpxchg(value, v, v + n);
+		if (seen == v)
+		{
+			break;
+		}
+		v = seen;
+	}
+	slot = sem_slot_for(ref);
+	if (slot != NULL)
+	{
+		sem_unboost(slot);					//holder is letting go, drop any boost it got
+		slot->stats.ups += n;
+	}
+	cs1550_count(ups, n);
+	//each waiter is one below zero, the first -v of them get a unit
+	while (v < 0 && n-- > 0 && sem_wake_one(ref))
+	{
+		v++;
+	}
+	return 0;
+}
+
+asmlinkage long sys_cs1550_up(struct cs1550_sem* sem)
+{
+	struct cs1550_semref ref;
+	long ret = sem_get(&ref, sem);
+
+	if (ret)
+	{
+		return ret;
+	}
+	sem_lock_traced(&ref);					//entering critical region
+	ret = sem_release(&ref, 1);
+	spin_unlock(&ref.bucket->lock);			//release spinlock, done with critical
+	sem_put(&ref);
+	return ret;
+}
+
+//release n units at once, waking up to n waiters in FIFO order under a single lock hold
+//-EINVAL for n < 1, -EOVERFLOW if the count would pass INT_MAX
+asmlinkage long sys_cs1550_up_n(struct cs1550_sem* sem, int n)
+{
+	struct cs1550_semref ref;
+	long ret;
+
+	if (n < 1)
+	{
+		return -EINVAL;
+	}
+	ret = sem_get(&ref, sem);
+	if (ret)
+	{
+		return ret;
+	}
+	spin_lock(&ref.bucket->lock);			//entering critical region
+	ret = sem_release(&ref, n);
+	spin_unlock(&ref.bucket->lock);			//release spinlock, done with critical
+	sem_put(&ref);
+	return ret;
+}
+
+//take a unit only if one is free right now, returns -EAGAIN instead of sleeping
+asmlinkage long sys_cs1550_trydown(struct cs1550_sem* sem)
+{
+	struct cs1550_semref ref;
+	long ret = sem_get(&ref, sem);
+
+	if (ret)
+	{
+		return ret;
+	}
+	spin_lock(&ref.bucket->lock);			//entering critical region
+	if (sem_try_take(sem))
+	{
+		sem_acquired(&ref);
+	} else
+	{
+		ret = -EAGAIN;
+	}
+	spin_unlock(&ref.bucket->lock);			//leaving critical section
+	sem_put(&ref);
+	return ret;
+}
+
+//down that gives up after a relative timeout, returns -ETIMEDOUT if no unit arrived in time
+asmlinkage long sys_cs1550_down_timeout(struct cs1550_sem* sem, struct timespec __user* utimeout)
+{
+	struct cs1550_semref ref;
+	struct cs1550_waiter waiter;
+	struct hrtimer_sleeper timeout;			//wakes us and clears timeout.task on expiry
+	struct timespec ts;
+	long ret = 0;
+
+	if (copy_from_user(&ts, utimeout, sizeof(ts)))
+	{
+		return -EFAULT;
+	}
+	if (!timespec_valid(&ts))
+	{
+		return -EINVAL;
+	}
+	ret = sem_get(&ref, sem);
+	if (ret)
+	{
+		return ret;
+	}
+
+	spin_lock(&ref.bucket->lock);			//entering critical region
+	if (atomic_dec_return(sem_value(sem)) >= 0)
+	{
+		sem_acquired(&ref);
+		spin_unlock(&ref.bucket->lock);		//got one, no timer needed
+		sem_put(&ref);
+		return 0;
+	}
+	hrtimer_init(&timeout.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	hrtimer_init_sleeper(&timeout, current);
+	hrtimer_start(&timeout.timer, timespec_to_ktime(ts), HRTIMER_MODE_REL);
+	sem_queue(&ref, &waiter);
+	ret = sem_wait(&ref, &waiter, &timeout);
+	if (ret == 0)
+	{
+		sem_acquired(&ref);
+	}
+	spin_unlock(&ref.bucket->lock);			//leaving critical section
+
+	//timer lives on our stack too, make sure its callback is done before returning
+	hrtimer_cancel(&timeout.timer);
+	sem_put(&ref);
+	return ret;
+}
+
+//lock a sorted list of distinct buckets, ascending order keeps multi-lock callers deadlock free
+static void sem_lock_buckets(int* buckets, int n)
+{
+	int i;
+	for (i = 0; i < n; i++)
+	{
+		spin_lock(&sem_buckets[buckets[i]].lock);
+	}
+}
+
+//unlock a list of buckets, leaving bucket keep (if any) locked
+static void sem_unlock_buckets(int* buckets, int n, int keep)
+{
+	int i;
+	for (i = n - 1; i >= 0; i--)
+	{
+		if (buckets[i] != keep)
+		{
+			spin_unlock(&sem_buckets[buckets[i]].lock);
+		}
+	}
+}
+
+//up one semaphore and down another as one step, the caller is on down_sem's queue before
+//the up is visible to anyone, so whatever the up sets in motion cannot wake others past us
+//the up always happens, even if the down is then cut short by a signal
+//-EOVERFLOW, with neither done, if the up would take up_sem's count past INT_MAX
+asmlinkage long sys_cs1550_up_down(struct cs1550_sem* up_sem, struct cs1550_sem* down_sem)
+{
+	struct cs1550_semref up_ref, down_ref;
+	int buckets[2];
+	int nbuckets = 1;
+	int b;
+	struct cs1550_waiter waiter;
+	long ret = sem_get(&up_ref, up_sem);
+
+	if (ret)
+	{
+		return ret;
+	}
+	ret = sem_get(&down_ref, down_sem);
+	if (ret)
+	{
+		sem_put(&up_ref);
+		return ret;
+	}
+	if (cs1550_key_match(&up_ref.key, &down_ref.key))
+	{
+		ret = -EINVAL;						//one semaphore, perhaps mapped at two addresses
+		goto out;
+	}
+	//both locks in ascending order, the same order cs1550_semop() uses
+	b = down_ref.bucket - sem_buckets;
+	buckets[0] = up_ref.bucket - sem_buckets;
+	if (b != buckets[0])
+	{
+		buckets[nbuckets++] = b;
+		if (buckets[0] > b)
+		{
+			buckets[1] = buckets[0];
+			buckets[0] = b;
+		}
+	}
+	sem_lock_buckets(buckets, nbuckets);
+	if (!sem_room(&up_ref, 1))
+	{
+		sem_unlock_buckets(buckets, nbuckets, -1);
+		ret = -EOVERFLOW;					//neither the up nor the down happened
+		goto out;
+	}
+
+	//the check above is only a hint, the user fast path can still add to up_sem's count
+	//before sem_release() runs, so if it fails take the down back and report neither
+	if (atomic_dec_return(sem_value(down_sem)) < 0)
+	{
+		sem_queue(&down_ref, &waiter);
+		ret = sem_release(&up_ref, 1);
+		if (ret)
+		{
+			sem_unqueue(&down_ref, &waiter);
+			sem_unlock_buckets(buckets, nbuckets, -1);
+			goto out;
+		}
+		sem_unlock_buckets(buckets, nbuckets, b);
+		ret = sem_wait(&down_ref, &waiter, NULL);
+	} else
+	{
+		ret = sem_release(&up_ref, 1);
+		if (ret)
+		{
+			atomic_inc(sem_value(down_sem));	//count was not negative, nobody to wake
+			sem_unlock_buckets(buckets, nbuckets, -1);
+			goto out;
+		}
+		sem_unlock_buckets(buckets, nbuckets, b);
+	}
+	if (ret == 0)
+	{
+		sem_acquired(&down_ref);
+	}
+	spin_unlock(&down_ref.bucket->lock);
+out:
+	sem_put(&down_ref);
+	sem_put(&up_ref);
+	return ret;
+}
+
+//apply a batch of downs and ups as one step, System V semop() style: either every
+//down gets a unit and all ups are applied, or nothing changes and we sleep
+//while sleeping we wait as an ordinary down on the first semaphore that was short,
+//so up() from the kernel or the user fast path wakes us, then we retry the batch
+//-EOVERFLOW, with nothing applied, if an up would take a count past INT_MAX
+asmlinkage long sys_cs1550_semop(struct cs1550_sembuf __user* uops, int nops)
+{
+	struct cs1550_sembuf ops[CS1550_SEMOP_MAX];
+	struct cs1550_semref refs[CS1550_SEMOP_MAX];	//one per op, the first nrefs filled in
+	int buckets[CS1550_SEMOP_MAX];			//distinct buckets touched, ascending
+	int nbuckets = 0;
+	int nrefs = 0;
+	struct cs1550_semref* held = NULL;		//unit already won by sleeping, counts toward this batch
+	struct cs1550_semref* short_ref;
+	struct cs1550_waiter waiter;
+	int i, j, b;
+	long ret = 0;
+
+	if (nops < 1 || nops > CS1550_SEMOP_MAX)
+	{
+		return -EINVAL;
+	}
+	if (copy_from_user(ops, uops, nops * sizeof(struct cs1550_sembuf)))
+	{
+		return -EFAULT;
+	}
+	for (i = 0; i < nops; i++)
+	{
+		//each semaphore once, downs by exactly one
+		if (ops[i].delta == 0 || ops[i].delta < -1)
+		{
+			ret = -EINVAL;
+			goto out;
+		}
+		ret = sem_get(&refs[i], ops[i].sem);
+		if (ret)
+		{
+			goto out;
+		}
+		nrefs++;
+		for (j = 0; j < i; j++)
+		{
+			if (cs1550_key_match(&refs[j].key, &refs[i].key))
+			{
+				ret = -EINVAL;
+				goto out;
+			}
+		}
+		//insert bucket into sorted list if it is new
+		b = refs[i].bucket - sem_buckets;
+		for (j = nbuckets; j > 0 && buckets[j - 1] > b; j--)
+		{
+			buckets[j] = buckets[j - 1];
+		}
+		if (j > 0 && buckets[j - 1] == b)
+		{
+			for (; j < nbuckets; j++)
+			{
+				buckets[j] = buckets[j + 1];			//duplicate, undo the shift
+			}
+			continue;
+		}
+		buckets[j] = b;
+		nbuckets++;
+	}
+
+	for (;;)
+	{
+		short_ref = NULL;
+		sem_lock_buckets(buckets, nbuckets);
+
+		//every up has to fit before anything is applied
+		for (i = 0; i < nops; i++)
+		{
+			if (ops[i].delta > 0 && !sem_room(&refs[i], ops[i].delta))
+			{
+				ret = -EOVERFLOW;
+			}
+		}
+		if (ret)
+		{
+			if (held != NULL)
+			{
+				sem_release(held, 1);
+			}
+			sem_unlock_buckets(buckets, nbuckets, -1);
+			break;
+		}
+
+		//take every down, stop at the first semaphore with nothing left
+		for (i = 0; i < nops; i++)
+		{
+			if (ops[i].delta > 0 || &refs[i] == held)
+			{
+				continue;
+			}
+			if (!sem_try_take(refs[i].sem))
+			{
+				short_ref = &refs[i];
+				break;
+			}
+		}
+		if (short_ref == NULL)
+		{
+			for (i = 0; i < nops; i++)
+			{
+				if (ops[i].delta > 0)
+				{
+					sem_release(&refs[i], ops[i].delta);
+				} else
+				{
+					sem_acquired(&refs[i]);
+				}
+			}
+			sem_unlock_buckets(buckets, nbuckets, -1);
+			break;
+		}
+
+		//back out the units taken so far, they were positive so nobody is queued on them
+		for (j = 0; j < i; j++)
+		{
+			if (ops[j].delta < 0 && &refs[j] != held)
+			{
+				atomic_inc(sem_value(refs[j].sem));
+			}
+		}
+		if (held != NULL)
+		{
+			sem_release(held, 1);				//do not sit on a unit while waiting for another
+			held = NULL;
+		}
+
+		//queue on the short semaphore like a normal down
+		b = short_ref->bucket - sem_buckets;
+		if (atomic_dec_return(sem_value(short_ref->sem)) >= 0)
+		{
+			held = short_ref;					//a unit arrived through the fast path meanwhile
+			sem_unlock_buckets(buckets, nbuckets, -1);
+			continue;
+		}
+		sem_unlock_buckets(buckets, nbuckets, b);
+		sem_queue(short_ref, &waiter);
+		ret = sem_wait(short_ref, &waiter, NULL);
+		spin_unlock(&short_ref->bucket->lock);
+		if (ret)
+		{
+			break;
+		}
+		held = short_ref;
+	}
+out:
+	for (i = 0; i < nrefs; i++)
+	{
+		sem_put(&refs[i]);
+	}
+	return ret;
+}
+
+//Kernel-managed semaphores: user space holds only an integer handle, the count lives in
+//ksem_table and sleepers queue on a list of their own in the entry, so nothing the kernel
+//trusts is kept in user memory and up() wakes the oldest without searching the bucket.
+//Handles are global, like System V semaphore ids, and likewise only the creator's user
+//(or CAP_IPC_OWNER) may use or destroy one. Nothing frees them when a process exits, so
+//each user may hold only CS1550_HANDLES_PER_USER at a time and cannot fill the table for
+//everyone else.
+
+#define CS1550_HANDLE_BITS 10
+#define CS1550_MAX_HANDLES (1 << CS1550_HANDLE_BITS)
+#define CS1550_HANDLE_GEN_MASK 0xfffff		//generation bits, keeps handles positive
+#define CS1550_HANDLES_PER_USER (CS1550_MAX_HANDLES / 4)
+
+//table entry, guarded by the bucket lock of its index except for uid and allocated, which
+//ksem_alloc_lock guards and which do not change while in_use is set
+struct cs1550_ksem
+{
+	int value;
+	int in_use;
+	int allocated;					//off the free list, in_use may not be set yet
+	uid_t uid;						//effective uid of the creator
+	unsigned int gen;				//bumped on destroy so stale handles stop matching
+	int nwaiters;					//tasks queued on this semaphore
+	struct list_head waiters;		//those tasks, oldest first, under the bucket lock
+	int nfds;						//open files from cs1550_sem_fd(), keep destroy away
+	wait_queue_head_t pollers;		//poll/select/epoll on those files, woken when the count goes up
+};
+
+//queue at the tail of queue and sleep until a waker grants us the object and sets woken,
+//returns -EINTR if a signal comes first, in which case we are off the list and the caller
+//must undo its own bookkeeping
+//called with the bucket lock held, the lock guarding queue, and returns with it held
+static long waiter_sleep_on(struct cs1550_bucket* bucket, struct list_head* queue,
+	struct cs1550_waiter* waiter, union futex_key* key)
+{
+	long ret = 0;
+
+	waiter->key = *key;
+	waiter->task = current;
+	waiter->woken = 0;
+	list_add_tail(&waiter->list, queue);
+	for (;;)
+	{
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (waiter->woken)
+		{
+			break;							//waker already took us off the list
+		}
+		if (signal_pending(current))
+		{
+			list_del(&waiter->list);
+			ret = -EINTR;
+			break;
+		}
+		spin_unlock(&bucket->lock);
+		schedule();
+		spin_lock(&bucket->lock);
+	}
+	__set_current_state(TASK_RUNNING);
+	return ret;
+}
+
+//waiter_sleep_on() the bucket's own list, for objects that share it by key
+static long waiter_sleep(struct cs1550_bucket* bucket, struct cs1550_waiter* waiter, union futex_key* key)
+{
+	return waiter_sleep_on(bucket, &bucket->waiters, waiter, key);
+}
+
+//key for an object in kernel memory, such as a ksem, never equal to a user memory key
+static void cs1550_kernel_key(void* obj, union futex_key* key)
+{
+	key->both.word = 0;
+	key->both.ptr = obj;
+	key->both.offset = 0;
+}
+
+static struct cs1550_ksem ksem_table[CS1550_MAX_HANDLES];
+
+//indices given back by destroy, and the first never used one
+static DEFINE_SPINLOCK(ksem_alloc_lock);
+static int ksem_free[CS1550_MAX_HANDLES];
+static int ksem_nfree;
+static int ksem_high;
+
+static int ksem_index(int handle)
+{
+	return handle & (CS1550_MAX_HANDLES - 1);
+}
+
+static struct cs1550_bucket* ksem_bucket(int index)
+{
+	return &sem_buckets[hash_long(index, CS1550_LOCK_BITS)];
+}
+
+//entry for a live handle or NULL, caller holds the bucket lock of the handle's index
+static struct cs1550_ksem* ksem_lookup(int handle)
+{
+	struct cs1550_ksem* ksem;
+
+	if (handle < 0)
+	{
+		return NULL;
+	}
+	ksem = &ksem_table[ksem_index(handle)];
+	if (!ksem->in_use || ksem->gen != (unsigned int)handle >> CS1550_HANDLE_BITS)
+	{
+		return NULL;
+	}
+	return ksem;
+}
+
+//the creator's user, or a task allowed to override IPC permissions, as with System V
+//semaphores
+static int ksem_permitted(struct cs1550_ksem* ksem)
+{
+	return ksem->uid == current->euid || capable(CAP_IPC_OWNER);
+}
+
+//live entry for a handle the caller may use, or NULL with the error in *ret, caller holds
+//the bucket lock of the handle's index
+static struct cs1550_ksem* ksem_lookup_permitted(int handle, long* ret)
+{
+	struct cs1550_ksem* ksem = ksem_lookup(handle);
+
+	if (ksem == NULL)
+	{
+		*ret = -EINVAL;
+	} else if (!ksem_permitted(ksem))
+	{
+		*ret = -EACCES;
+		ksem = NULL;
+	}
+	return ksem;
+}
+
+//handles the user holds, caller holds ksem_alloc_lock
+static int ksem_count_user(uid_t uid)
+{
+	int count = 0;
+	int i;
+
+	for (i = 0; i < ksem_high; i++)
+	{
+		if (ksem_table[i].allocated && ksem_table[i].uid == uid)
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+//new semaphore with the given count, returns its handle or -ENOSPC when the table is full
+//or the caller's user already holds CS1550_HANDLES_PER_USER
+asmlinkage long sys_cs1550_create(int value)
+{
+	struct cs1550_bucket* bucket;
+	struct cs1550_ksem* ksem;
+	int index;
+	long handle;
+
+	if (value < 0)
+	{
+		return -EINVAL;
+	}
+	spin_lock(&ksem_alloc_lock);
+	if (ksem_count_user(current->euid) >= CS1550_HANDLES_PER_USER)
+	{
+		spin_unlock(&ksem_alloc_lock);
+		return -ENOSPC;
+	}
+	if (ksem_nfree > 0)
+	{
+		index = ksem_free[--ksem_nfree];
+	} else if (ksem_high < CS1550_MAX_HANDLES)
+	{
+		index = ksem_high++;
+	} else
+	{
+		spin_unlock(&ksem_alloc_lock);
+		return -ENOSPC;
+	}
+	ksem_table[index].allocated = 1;
+	ksem_table[index].uid = current->euid;
+	spin_unlock(&ksem_alloc_lock);
+
+	bucket = ksem_bucket(index);
+	ksem = &ksem_table[index];
+	spin_lock(&bucket->lock);
+	ksem->value = value;
+	ksem->nwaiters = 0;
+	INIT_LIST_HEAD(&ksem->waiters);
+	ksem->nfds = 0;
+	init_waitqueue_head(&ksem->pollers);	//empty, nothing can poll a freed entry
+	ksem->in_use = 1;
+	handle = ((long)ksem->gen << CS1550_HANDLE_BITS) | index;
+	spin_unlock(&bucket->lock);
+	return handle;
+}
+
+//free a semaphore, -EBUSY while tasks are still asleep on it or it is open as a file
+asmlinkage long sys_cs1550_destroy(int handle)
+{
+	struct cs1550_bucket* bucket = ksem_bucket(ksem_index(handle));
+	struct cs1550_ksem* ksem;
+	long ret;
+
+	spin_lock(&bucket->lock);
+	ksem = ksem_lookup_permitted(handle, &ret);
+	if (ksem == NULL)
+	{
+		spin_unlock(&bucket->lock);
+		return ret;
+	}
+	if (ksem->nwaiters > 0 || ksem->nfds > 0)
+	{
+		spin_unlock(&bucket->lock);
+		return -EBUSY;
+	}
+	ksem->in_use = 0;
+	ksem->gen = (ksem->gen + 1) & CS1550_HANDLE_GEN_MASK;
+	spin_unlock(&bucket->lock);
+
+	spin_lock(&ksem_alloc_lock);
+	ksem->allocated = 0;
+	ksem_free[ksem_nfree++] = ksem_index(handle);
+	spin_unlock(&ksem_alloc_lock);
+	return 0;
+}
+
+//down for the syscall and for read() on a semaphore file, -EAGAIN instead of sleeping
+//if nonblock is set; an open file already passed the permission check in
+//cs1550_sem_fd() and works for whoever it is handed to, like any other fd
+static long ksem_down(int handle, int nonblock, int from_file)
+{
+	struct cs1550_bucket* bucket = ksem_bucket(ksem_index(handle));
+	struct cs1550_ksem* ksem;
+	struct cs1550_waiter waiter;
+	union futex_key key;
+	long ret = 0;
+
+	spin_lock(&bucket->lock);				//entering critical region
+	ksem = from_file ? ksem_lookup(handle) : ksem_lookup_permitted(handle, &ret);
+	if (ksem == NULL)
+	{
+		spin_unlock(&bucket->lock);
+		return from_file ? -EINVAL : ret;
+	}
+	if (nonblock && ksem->value <= 0)
+	{
+		spin_unlock(&bucket->lock);
+		return -EAGAIN;
+	}
+	if (--ksem->value < 0)
+	{
+		//out of resources, queue behind everyone already asleep on this semaphore
+		ksem->nwaiters++;
+		cs1550_kernel_key(ksem, &key);
+		ret = waiter_sleep_on(bucket, &ksem->waiters, &waiter, &key);
+		if (ret)
+		{
+			ksem->nwaiters--;
+			ksem->value++;
+		}
+	}
+	spin_unlock(&bucket->lock);				//leaving critical section
+	return ret;
+}
+
+asmlinkage long sys_cs1550_down_handle(int handle)
+{
+	return ksem_down(handle, 0, 0);
+}
+
+//up for the syscall and for giving back a unit read() could not deliver
+static long ksem_up(int handle, int from_file)
+{
+	struct cs1550_bucket* bucket = ksem_bucket(ksem_index(handle));
+	struct cs1550_ksem* ksem;
+	long ret = 0;
+
+	spin_lock(&bucket->lock);				//entering critical region
+	ksem = from_file ? ksem_lookup(handle) : ksem_lookup_permitted(handle, &ret);
+	if (ksem == NULL)
+	{
+		spin_unlock(&bucket->lock);
+		return from_file ? -EINVAL : ret;
+	}
+	if (++ksem->value <= 0)
+	{
+		//a negative count means someone is asleep, the oldest is first on the list
+		if (!list_empty(&ksem->waiters))
+		{
+			ksem->nwaiters--;
+			waiter_grant(list_entry(ksem->waiters.next, struct cs1550_waiter, list));
+		}
+	} else if (waitqueue_active(&ksem->pollers))
+	{
+		//nobody asleep in down, a unit is free for whoever reads a file first
+		wake_up_interruptible(&ksem->pollers);
+	}
+	spin_unlock(&bucket->lock);				//release spinlock, done with critical
+	return 0;
+}
+
+asmlinkage long sys_cs1550_up_handle(int handle)
+{
+	return ksem_up(handle, 0);
+}
+
+//Semaphore files: cs1550_sem_fd() wraps a handle in an anonymous file, readable while a
+//down would not sleep, so one thread can wait on many semaphores and other fds together
+//with poll, select or epoll. read() does the down and returns the int 1, the unit taken.
+//The file keeps the handle alive, destroy fails with -EBUSY until the last close.
+
+static int ksem_file_handle(struct file* file)
+{
+	return (int)(long)file->private_data;
+}
+
+static unsigned int ksem_fd_poll(struct file* file, poll_table* wait)
+{
+	int handle = ksem_file_handle(file);
+	struct cs1550_bucket* bucket = ksem_bucket(ksem_index(handle));
+	struct cs1550_ksem* ksem = &ksem_table[ksem_index(handle)];
+	unsigned int mask = 0;
+
+	//on the wait queue before looking, under the lock up checks it under
+	poll_wait(file, &ksem->pollers, wait);
+	spin_lock(&bucket->lock);
+	if (ksem->value > 0)
+	{
+		mask = POLLIN | POLLRDNORM;
+	}
+	spin_unlock(&bucket->lock);
+	return mask;
+}
+
+static ssize_t ksem_fd_read(struct file* file, char __user* buf, size_t count, loff_t* ppos)
+{
+	int handle = ksem_file_handle(file);
+	int taken = 1;
+	long ret;
+
+	if (count < sizeof(taken))
+	{
+		return -EINVAL;
+	}
+	ret = ksem_down(handle, file->f_flags & O_NONBLOCK, 1);
+	if (ret)
+	{
+		return ret;
+	}
+	if (copy_to_user(buf, &taken, sizeof(taken)))
+	{
+		ksem_up(handle, 1);					//nobody saw the unit, give it back
+		return -EFAULT;
+	}
+	return sizeof(taken);
+}
+
+static int ksem_fd_release(struct inode* inode, struct file* file)
+{
+	int handle = ksem_file_handle(file);
+	struct cs1550_bucket* bucket = ksem_bucket(ksem_index(handle));
+
+	spin_lock(&bucket->lock);
+	ksem_table[ksem_index(handle)].nfds--;
+	spin_unlock(&bucket->lock);
+	return 0;
+}
+
+static const struct file_operations ksem_fd_fops = {
+	.poll		= ksem_fd_poll,
+	.read		= ksem_fd_read,
+	.release	= ksem_fd_release,
+};
+
+//new fd for a live handle, closed with close() like any other
+asmlinkage long sys_cs1550_sem_fd(int handle)
+{
+	struct cs1550_bucket* bucket = ksem_bucket(ksem_index(handle));
+	struct cs1550_ksem* ksem;
+	struct inode* inode;
+	struct file* file;
+	int fd;
+	long ret;
+
+	spin_lock(&bucket->lock);
+	ksem = ksem_lookup_permitted(handle, &ret);
+	if (ksem == NULL)
+	{
+		spin_unlock(&bucket->lock);
+		return ret;
+	}
+	ksem->nfds++;
+	spin_unlock(&bucket->lock);
+
+	ret = anon_inode_getfd(&fd, &inode, &file, "[cs1550_sem]", &ksem_fd_fops,
+	                       (void*)(long)handle);
+	if (ret)
+	{
+		spin_lock(&bucket->lock);
+		ksem->nfds--;
+		spin_unlock(&bucket->lock);
+		return ret;
+	}
+	return fd;
+}
+
+//Reader-writer semaphores: any number of readers or one writer. The state is two ints in
+//user memory that only the kernel touches, under the bucket lock of the rwsem's key, which
+//is found the same way as a cs1550_sem's.
+//Waiters queue FIFO in that bucket and a reader that arrives while anyone is queued waits
+//too, so a steady stream of readers cannot starve a writer, as with the kernel's rwsem.
+//The state is copied in and out with page faults disabled, since we may not sleep under
+//the lock. A fault drops the lock, brings the page in and starts over, and every change
+//is stored back before anyone is woken or queued, so starting over never repeats one.
+
+struct cs1550_rwsem
+{
+	int active;						//readers inside, or -1 while a writer is
+	int waiting;					//tasks queued on this rwsem
+};
+
+//key and bucket for the rwsem, barrier or eventcount at uaddr, drop the key with
+//cs1550_put_key()
+static long object_get(void __user* uaddr, union futex_key* key, struct cs1550_bucket** bucket)
+{
+	long ret = cs1550_get_key(uaddr, key);
+
+	if (ret == 0)
+	{
+		*bucket = &sem_buckets[key_bucket_index(key)];
+	}
+	return ret;
+}
+
+//copy an object's state in or out under the bucket lock, -EFAULT if its page is not there
+//right now, in which case the caller drops the lock and calls object_fault_in()
+static long object_read(void* st, void __user* uaddr, unsigned long len)
+{
+	unsigned long left;
+
+	pagefault_disable();
+	left = __copy_from_user_inatomic(st, uaddr, len);
+	pagefault_enable();
+	return left ? -EFAULT : 0;
+}
+
+static long object_write(void __user* uaddr, void* st, unsigned long len)
+{
+	unsigned long left;
+
+	pagefault_disable();
+	left = __copy_to_user_inatomic(uaddr, st, len);
+	pagefault_enable();
+	return left ? -EFAULT : 0;
+}
+
+//make the pages under an object present and writable, may sleep, so no bucket lock held
+//-EFAULT if they are not writable memory of ours
+static long object_fault_in(void __user* uaddr, unsigned long len)
+{
+	unsigned long start = (unsigned long)uaddr & PAGE_MASK;
+	unsigned long end = ((unsigned long)uaddr + len - 1) & PAGE_MASK;
+	struct page* page;
+	long ret = 0;
+
+	down_read(&current->mm->mmap_sem);
+	for (; start <= end && ret == 0; start += PAGE_SIZE)
+	{
+		if (get_user_pages(current, current->mm, start, 1, 1, 0, &page, NULL) < 1)
+		{
+			ret = -EFAULT;
+		} else
+		{
+			put_page(page);
+		}
+	}
+	up_read(&current->mm->mmap_sem);
+	return ret;
+}
+
+//how many waiters at the front of the queue fit: a writer once the rwsem is free, readers
+//until the first writer; st is updated as if they were admitted, caller holds the bucket
+//lock and grants them with object_grant() once st is stored
+static int rwsem_admit(struct cs1550_bucket* bucket, struct cs1550_rwsem* st, union futex_key* key)
+{
+	struct cs1550_waiter* waiter;
+	int n = 0;
+
+	list_for_each_entry(waiter, &bucket->waiters, list)
+	{
+		if (!cs1550_key_match(&waiter->key, key))
+		{
+			continue;
+		}
+		if (waiter->write)
+		{
+			if (st->active == 0)
+			{
+				st->active = -1;
+				st->waiting--;
+				n++;
+			}
+			break;							//everyone behind a writer keeps waiting
+		}
+		if (st->active < 0)
+		{
+			break;
+		}
+		st->active++;
+		st->waiting--;
+		n++;
+	}
+	return n;
+}
+
+//wake the first n waiters on key in queue order, or all of them if n is negative, caller
+//holds the bucket lock
+static void object_grant(struct cs1550_bucket* bucket, union futex_key* key, int n)
+{
+	struct cs1550_waiter* waiter;
+	struct cs1550_waiter* next;
+
+	list_for_each_entry_safe(waiter, next, &bucket->waiters, list)
+	{
+		if (n == 0)
+		{
+			break;
+		}
+		if (cs1550_key_match(&waiter->key, key))
+		{
+			waiter_grant(waiter);
+			n--;
+		}
+	}
+}
+
+//sleep as a reader or writer until another task admits us, caller holds the bucket lock
+//and has already counted us in waiting
+static long rwsem_wait(struct cs1550_bucket* bucket, struct cs1550_rwsem __user* rw,
+	union futex_key* key, int write)
+{
+	struct cs1550_waiter waiter;
+	struct cs1550_rwsem st;
+	long ret, fault;
+	int n;
+
+	waiter.write = write;
+	ret = waiter_sleep(bucket, &waiter, key);
+	if (ret == 0)
+	{
+		return 0;
+	}
+	//leaving may unblock readers that were queued behind us; if the page is gone for
+	//good our count is left behind, as with any other write to an unmapped rwsem
+	for (;;)
+	{
+		if (object_read(&st, rw, sizeof(st)) == 0)
+		{
+			st.waiting--;
+			n = rwsem_admit(bucket, &st, key);
+			if (object_write(rw, &st, sizeof(st)) == 0)
+			{
+				object_grant(bucket, key, n);
+				break;
+			}
+		}
+		spin_unlock(&bucket->lock);
+		fault = object_fault_in(rw, sizeof(st));
+		spin_lock(&bucket->lock);
+		if (fault)
+		{
+			break;
+		}
+	}
+	return ret;
+}
+
+//take the rwsem for reading or writing, behind anyone already queued
+static long rwsem_down(struct cs1550_rwsem __user* rw, int write)
+{
+	struct cs1550_bucket* bucket;
+	struct cs1550_rwsem st;
+	union futex_key key;
+	int queued;
+	long ret = object_get(rw, &key, &bucket);
+
+	if (ret)
+	{
+		return ret;
+	}
+	for (;;)
+	{
+		spin_lock(&bucket->lock);
+		if (object_read(&st, rw, sizeof(st)) == 0)
+		{
+			queued = st.waiting > 0 || (write ? st.active != 0 : st.active < 0);
+			if (queued)
+			{
+				st.waiting++;
+			} else
+			{
+				st.active = write ? -1 : st.active + 1;
+			}
+			if (object_write(rw, &st, sizeof(st)) == 0)
+			{
+				break;						//stored, keep the lock
+			}
+		}
+		spin_unlock(&bucket->lock);
+		ret = object_fault_in(rw, sizeof(st));
+		if (ret)
+		{
+			cs1550_put_key(&key);
+			return ret;
+		}
+	}
+	if (queued)
+	{
+		ret = rwsem_wait(bucket, rw, &key, write);
+	}
+	spin_unlock(&bucket->lock);
+	cs1550_put_key(&key);
+	return ret;
+}
+
+//release a read or write hold, -EINVAL if no task holds it that way
+//the last reader out, or a writer, lets in whoever is first in line
+static long rwsem_up(struct cs1550_rwsem __user* rw, int write)
+{
+	struct cs1550_bucket* bucket;
+	struct cs1550_rwsem st;
+	union futex_key key;
+	int n = 0;
+	long ret = object_get(rw, &key, &bucket);
+
+	if (ret)
+	{
+		return ret;
+	}
+	for (;;)
+	{
+		spin_lock(&bucket->lock);
+		if (object_read(&st, rw, sizeof(st)) == 0)
+		{
+			if (write ? st.active != -1 : st.active <= 0)
+			{
+				ret = -EINVAL;
+				break;
+			}
+			st.active = write ? 0 : st.active - 1;
+			if (st.active == 0 && st.waiting > 0)
+			{
+				n = rwsem_admit(bucket, &st, &key);
+			}
+			if (object_write(rw, &st, sizeof(st)) == 0)
+			{
+				object_grant(bucket, &key, n);
+				break;
+			}
+		}
+		spin_unlock(&bucket->lock);
+		ret = object_fault_in(rw, sizeof(st));
+		if (ret)
+		{
+			cs1550_put_key(&key);
+			return ret;
+		}
+	}
+	spin_unlock(&bucket->lock);
+	cs1550_put_key(&key);
+	return ret;
+}
+
+asmlinkage long sys_cs1550_down_read(struct cs1550_rwsem __user* rw)
+{
+	return rwsem_down(rw, 0);
+}
+
+asmlinkage long sys_cs1550_down_write(struct cs1550_rwsem __user* rw)
+{
+	return rwsem_down(rw, 1);
+}
+
+asmlinkage long sys_cs1550_up_read(struct cs1550_rwsem __user* rw)
+{
+	return rwsem_up(rw, 0);
+}
+
+asmlinkage long sys_cs1550_up_write(struct cs1550_rwsem __user* rw)
+{
+	return rwsem_up(rw, 1);
+}
+
+//Barriers and eventcounts, user memory state guarded by the bucket lock of its key and
+//copied in and out like the rwsem's, every waiter released by one call is granted in the
+//same pass over the bucket.
+
+//N-party barrier, set parties and zero the rest before first use
+struct cs1550_barrier
+{
+	int parties;					//tasks that must arrive to open it
+	int arrived;					//arrived in the current generation
+	unsigned int generation;		//bumped each time it opens
+};
+
+//eventcount, count only moves forward, awaiters sleep until it reaches their value
+//a sequencer to go with it is a plain counter in user memory taken with fetch-and-add
+struct cs1550_eventcount
+{
+	unsigned int count;
+};
+
+//take back the arrival of a waiter that a signal interrupted, returns -EINTR, or 0 if the
+//barrier opened with our arrival counted while the lock was dropped to fault its page in
+//called with the bucket lock held and returns with it held
+static long barrier_leave(struct cs1550_bucket* bucket, struct cs1550_barrier __user* b,
+	union futex_key* key, unsigned int generation)
+{
+	struct cs1550_barrier st;
+	long fault;
+
+	for (;;)
+	{
+		if (object_read(&st, b, sizeof(st)) == 0)
+		{
+			if (st.generation != generation)
+			{
+				return 0;
+			}
+			st.arrived--;
+			if (object_write(b, &st, sizeof(st)) == 0)
+			{
+				return -EINTR;
+			}
+		}
+		spin_unlock(&bucket->lock);
+		fault = object_fault_in(b, sizeof(st));
+		spin_lock(&bucket->lock);
+		if (fault)
+		{
+			return -EINTR;					//unmapped under us, nothing left to take back
+		}
+	}
+}
+
+//wait until parties tasks have called this, returns 1 in the task that opened the barrier
+//and 0 in the others, or -EINTR, in which case our arrival is taken back
+asmlinkage long sys_cs1550_barrier_wait(struct cs1550_barrier __user* b)
+{
+	struct cs1550_bucket* bucket;
+	struct cs1550_barrier st;
+	struct cs1550_waiter waiter;
+	union futex_key key;
+	unsigned int generation = 0;
+	int opened = 0;
+	long ret = object_get(b, &key, &bucket);
+
+	if (ret)
+	{
+		return ret;
+	}
+	for (;;)
+	{
+		spin_lock(&bucket->lock);
+		if (object_read(&st, b, sizeof(st)) == 0)
+		{
+			if (st.parties < 1)
+			{
+				ret = -EINVAL;
+				break;
+			}
+			generation = st.generation;
+			opened = ++st.arrived == st.parties;
+			if (opened)
+			{
+				st.arrived = 0;				//last one in, release the whole generation
+				st.generation++;
+			}
+			if (object_write(b, &st, sizeof(st)) == 0)
+			{
+				break;
+			}
+		}
+		spin_unlock(&bucket->lock);
+		ret = object_fault_in(b, sizeof(st));
+		if (ret)
+		{
+			cs1550_put_key(&key);
+			return ret;
+		}
+	}
+	if (ret == 0)
+	{
+		if (opened)
+		{
+			object_grant(bucket, &key, -1);
+			ret = 1;
+		} else if (waiter_sleep(bucket, &waiter, &key))
+		{
+			ret = barrier_leave(bucket, b, &key, generation);
+		}
+	}
+	spin_unlock(&bucket->lock);
+	cs1550_put_key(&key);
+	return ret;
+}
+
+//sleep until ec->count reaches value, counts are compared modulo 2^32
+asmlinkage long sys_cs1550_ec_await(struct cs1550_eventcount __user* ec, unsigned int value)
+{
+	struct cs1550_bucket* bucket;
+	struct cs1550_waiter waiter;
+	union futex_key key;
+	unsigned int count;
+	long ret = object_get(ec, &key, &bucket);
+
+	if (ret)
+	{
+		return ret;
+	}
+	for (;;)
+	{
+		spin_lock(&bucket->lock);
+		if (object_read(&count, &ec->count, sizeof(count)) == 0)
+		{
+			break;
+		}
+		spin_unlock(&bucket->lock);
+		ret = object_fault_in(ec, sizeof(*ec));
+		if (ret)
+		{
+			cs1550_put_key(&key);
+			return ret;
+		}
+	}
+	if ((int)(count - value) < 0)
+	{
+		waiter.target = value;
+		ret = waiter_sleep(bucket, &waiter, &key);
+	}
+	spin_unlock(&bucket->lock);
+	cs1550_put_key(&key);
+	return ret;
+}
+
+//add n to ec->count and wake every awaiter whose value it reached, returns 0, the new
+//count is in ec->count since any 32-bit count returned here could pass for an errno
+asmlinkage long sys_cs1550_ec_advance(struct cs1550_eventcount __user* ec, unsigned int n)
+{
+	struct cs1550_bucket* bucket;
+	struct cs1550_waiter* next;
+	struct cs1550_waiter* w;
+	union futex_key key;
+	unsigned int count;
+	long ret = object_get(ec, &key, &bucket);
+
+	if (ret)
+	{
+		return ret;
+	}
+	for (;;)
+	{
+		spin_lock(&bucket->lock);
+		if (object_read(&count, &ec->count, sizeof(count)) == 0)
+		{
+			count += n;
+			if (object_write(&ec->count, &count, sizeof(count)) == 0)
+			{
+				break;
+			}
+		}
+		spin_unlock(&bucket->lock);
+		ret = object_fault_in(ec, sizeof(*ec));
+		if (ret)
+		{
+			cs1550_put_key(&key);
+			return ret;
+		}
+	}
+	list_for_each_entry_safe(w, next, &bucket->waiters, list)
+	{
+		if (cs1550_key_match(&w->key, &key) && (int)(count - w->target) >= 0)
+		{
+			waiter_grant(w);
+		}
+	}
+	spin_unlock(&bucket->lock);
+	cs1550_put_key(&key);
+	return 0;
+}
+
+//sum the per-CPU counters, a reader racing with updates may see them slightly apart
+static void cs1550_global_stats(struct cs1550_stats* stats)
+{
+	int cpu;
+
+	memset(stats, 0, sizeof(*stats));
+	for_each_possible_cpu(cpu)
+	{
+		cs1550_stats_add(stats, &per_cpu(cs1550_cpu_stats, cpu));
+	}
+}
+
+//copy the counters of sem, or the global ones if sem is NULL
+//returns -ENOENT if sem has no statistics slot
+asmlinkage long sys_cs1550_stats(struct cs1550_sem* sem, struct cs1550_stats __user* ustats)
+{
+	struct cs1550_stats stats;
+
+	if (sem == NULL)
+	{
+		cs1550_global_stats(&stats);
+	} else
+	{
+		struct cs1550_semref ref;
+		struct cs1550_sem_slot* slots;
+		int i, found = 0;
+		long ret = sem_get(&ref, sem);
+
+		if (ret)
+		{
+			return ret;
+		}
+		slots = ref.bucket->slots;
+		spin_lock(&ref.bucket->lock);
+		for (i = 0; i < CS1550_SLOTS_PER_BUCKET; i++)
+		{
+			if (slots[i].in_use && cs1550_key_match(&slots[i].key, &ref.key))
+			{
+				stats = slots[i].stats;
+				found = 1;
+			}
+		}
+		spin_unlock(&ref.bucket->lock);
+		sem_put(&ref);
+		if (!found)
+		{
+			return -ENOENT;
+		}
+	}
+	if (copy_to_user(ustats, &stats, sizeof(stats)))
+	{
+		return -EFAULT;
+	}
+	return 0;
+}
+
+static void cs1550_show_stats(struct seq_file* m, struct cs1550_stats* s)
+{
+	seq_printf(m, "%12llu %10llu %10llu %8llu %12llu %14llu %12llu %6lld\n",
+		(unsigned long long)s->acquisitions, (unsigned long long)s->blocked,
+		(unsigned long long)s->spun, (unsigned long long)s->aborted,
+		(unsigned long long)s->ups, (unsigned long long)s->wait_ns,
+		(unsigned long long)s->max_wait_ns, (long long)s->depth);
+}
+
+//"inode:offset in the file" for a semaphore in a shared mapping, "mm:address" for one in
+//private memory, bit 0 of the offset marks an inode key
+static void cs1550_show_key(struct seq_file* m, union futex_key* key)
+{
+	unsigned long where = key->both.word;
+
+	if (key->both.offset & 1)
+	{
+		where <<= PAGE_SHIFT;				//page index in the file
+	}
+	seq_printf(m, "%16p:%-16lx ", key->both.ptr, where + (key->both.offset & ~3));
+}
+
+//global totals first, then one line per semaphore that holds a record, then what
+//semaphores that lost their record had counted, then whether tracing is on
+static int cs1550_proc_show(struct seq_file* m, void* v)
+{
+	struct cs1550_stats stats;
+	union futex_key key;
+	u64 dropped = 0;
+	int b, i, cpu, in_use;
+
+	cs1550_global_stats(&stats);
+	seq_printf(m, "%-33s %12s %10s %10s %8s %12s %14s %12s %6s\n", "semaphore", "acquisitions",
+		"blocked", "spun", "aborted", "ups", "wait_ns", "max_wait_ns", "depth");
+	seq_printf(m, "%-33s ", "total");
+	cs1550_show_stats(m, &stats);
+
+	for (b = 0; b < CS1550_LOCK_BUCKETS; b++)
+	{
+		for (i = 0; i < CS1550_SLOTS_PER_BUCKET; i++)
+		{
+			//snapshot under the lock, print outside it
+			spin_lock(&sem_buckets[b].lock);
+			in_use = sem_buckets[b].slots[i].in_use;
+			key = sem_buckets[b].slots[i].key;
+			stats = sem_buckets[b].slots[i].stats;
+			spin_unlock(&sem_buckets[b].lock);
+			if (in_use)
+			{
+				cs1550_show_key(m, &key);
+				cs1550_show_stats(m, &stats);
+			}
+		}
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	for_each_possible_cpu(cpu)
+	{
+		cs1550_stats_add(&stats, &per_cpu(cs1550_evicted_stats, cpu));
+		dropped += per_cpu(cs1550_trace_rings, cpu).dropped;
+	}
+	seq_printf(m, "%-33s ", "evicted");
+	cs1550_show_stats(m, &stats);
+	seq_printf(m, "tracing %s, %llu events dropped\n", cs1550_tracing ? "on" : "off",
+		(unsigned long long)dropped);
+	return 0;
+}
+
+static int cs1550_proc_open(struct inode* inode, struct file* file)
+{
+	return single_open(file, cs1550_proc_show, NULL);
+}
+
+static const struct file_operations cs1550_proc_fops = {
+	.open		= cs1550_proc_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+#define CS1550_TRACE_BATCH 8			//events copied out per ring lock hold, they pass through the stack
+
+//hand out whole events, oldest first within each CPU, and forget them
+//returns 0 once every ring is empty, a tool just reads again later
+static ssize_t cs1550_trace_read(struct file* file, char __user* buf, size_t count, loff_t* ppos)
+{
+	struct cs1550_trace_event batch[CS1550_TRACE_BATCH];
+	size_t room = count / sizeof(struct cs1550_trace_event);
+	ssize_t done = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+	{
+		struct cs1550_trace_ring* ring = &per_cpu(cs1550_trace_rings, cpu);
+
+		while (room > 0)
+		{
+			unsigned int n = 0;
+
+			spin_lock(&ring->lock);
+			while (n < CS1550_TRACE_BATCH && n < room && ring->count > 0)
+			{
+				unsigned int tail = (ring->head + CS1550_TRACE_EVENTS - ring->count) % CS1550_TRACE_EVENTS;
+				batch[n++] = ring->events[tail];
+				ring->count--;
+			}
+			spin_unlock(&ring->lock);
+			if (n == 0)
+			{
+				break;
+			}
+			//copy_to_user() may fault and sleep, so never under the ring lock
+			if (copy_to_user(buf + done, batch, n * sizeof(batch[0])))
+			{
+				return -EFAULT;
+			}
+			done += n * sizeof(batch[0]);
+			room -= n;
+		}
+	}
+	return done;
+}
+
+//"1" switches tracing on with empty rings, "0" switches it off
+static ssize_t cs1550_trace_write(struct file* file, const char __user* buf, size_t count,
+	loff_t* ppos)
+{
+	char c;
+	int cpu;
+
+	if (count == 0)
+	{
+		return 0;
+	}
+	if (copy_from_user(&c, buf, 1))
+	{
+		return -EFAULT;
+	}
+	if (c == '1')
+	{
+		for_each_possible_cpu(cpu)
+		{
+			struct cs1550_trace_ring* ring = &per_cpu(cs1550_trace_rings, cpu);
+			spin_lock(&ring->lock);
+			ring->count = 0;
+			ring->dropped = 0;
+			spin_unlock(&ring->lock);
+		}
+		cs1550_tracing = 1;
+	} else if (c == '0')
+	{
+		cs1550_tracing = 0;
+	} else
+	{
+		return -EINVAL;
+	}
+	return count;
+}
+
+static const struct file_operations cs1550_trace_fops = {
+	.read		= cs1550_trace_read,
+	.write		= cs1550_trace_write,
+};
+
+static int __init cs1550_init(void)
+{
+	struct proc_dir_entry* entry;
+	int b, cpu;
+
+	for (b = 0; b < CS1550_LOCK_BUCKETS; b++)
+	{
+		INIT_LIST_HEAD(&sem_buckets[b].waiters);
+	}
+	for_each_possible_cpu(cpu)
+	{
+		spin_lock_init(&per_cpu(cs1550_trace_rings, cpu).lock);
+	}
+	entry = create_proc_entry("cs1550_sem", S_IRUGO, NULL);
+	if (entry != NULL)
+	{
+		entry->proc_fops = &cs1550_proc_fops;
+	}
+	entry = create_proc_entry("cs1550_trace", S_IRUSR | S_IWUSR, NULL);
+	if (entry != NULL)
+	{
+		entry->proc_fops = &cs1550_trace_fops;
+	}
+	return 0;
+}
+__initcall(cs1550_init);
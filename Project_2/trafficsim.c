@@ -4,7 +4,6 @@
  *  Author: Michael Korst (mpk44@pitt.edu)
  */
 
-#include <linux/unistd.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <stdio.h>
@@ -13,25 +12,31 @@
 #include <sys/wait.h>
 #include <time.h>             //for rand generation
 
-#define BUFFER_SIZE 10            //max buffer always at 10 cars
+#include "cs1550.h"
 
-//redefine semaphore struct for main file
-struct cs1550_sem
-{
-	int value;
-	struct proc_node* head;					//start of process queue
-	struct proc_node* tail;					//end of process queue
-};
+#define BUFFER_SIZE 10            //max buffer always at 10 cars
+#define FLAG_NAP_NS 10000000LL    //longest a south car waits for a sleeping flagperson to notice, 10ms
 
-//wrapper functions for semaphore system calls
-void down(struct cs1550_sem *sem)
+//down (or up) two semaphores with a single syscall
+//a failed op changed nothing, carrying on would corrupt the buffers, so give up
+void down_both(struct cs1550_sem *a, struct cs1550_sem *b)
 {
-  syscall(__NR_cs1550_down, sem);
+  struct cs1550_sembuf ops[2] = { { a, -1 }, { b, -1 } };
+  if (cs1550_semop(ops, 2) != 0)
+  {
+    perror("cs1550_semop");
+    exit(1);
+  }
 }
 
-void up(struct cs1550_sem *sem)
+void up_both(struct cs1550_sem *a, struct cs1550_sem *b)
 {
-  syscall(__NR_cs1550_up, sem);
+  struct cs1550_sembuf ops[2] = { { a, 1 }, { b, 1 } };
+  if (cs1550_semop(ops, 2) != 0)
+  {
+    perror("cs1550_semop");
+    exit(1);
+  }
 }
 
 int main()
@@ -97,8 +102,7 @@ int main()
 		int r;						//random number for determining if another car appears
 		while (1)						//produce indefinitely in North
 		{
-			down(empty_north);				//removing empty spot
-			down(mutex);						//entering critical section
+			down_both(empty_north, mutex);				//removing empty spot and entering critical section
 			car = *prod_north;				//get car number
 			north_buf[*prod_north % BUFFER_SIZE] = car;									//insert car into north buf
 			//print out car arriving event
@@ -110,8 +114,7 @@ int main()
 				*blown = 1;
 			}
 			*prod_north = (*prod_north + 1) % BUFFER_SIZE;
-			up(mutex);								//out of critical section
-			up(full_north);						//adding another resource
+			up_both(mutex, full_north);								//out of critical section, adding another resource
 			r = rand() % 10;						//generate random to see if another car is coming
 			if (r >= 8)
 			{
@@ -126,8 +129,7 @@ int main()
 		int r;						//random number for determining if another car appears
 		while (1)						//produce indefinitely in South
 		{
-			down(empty_south);				//removing empty spot
-			down(mutex);						//entering critical section
+			down_both(empty_south, mutex);				//removing empty spot and entering critical section
 			car = *prod_south;				//get car number
 			south_buf[*prod_south % BUFFER_SIZE] = car;									//insert car into south buf
 			//print out car arriving event
@@ -139,8 +141,7 @@ int main()
 				*blown = 1;
 			}
 			*prod_south = (*prod_south + 1) % BUFFER_SIZE;
-			up(mutex);								//out of critical section
-			up(full_south);						//adding another resource
+			up_both(mutex, full_south);								//out of critical section, adding another resource
 			r = rand() % 10;						//generate random to see if another car is coming
 			if (r >= 8)
 			{
@@ -156,13 +157,18 @@ int main()
 		while (1)							//consume indefinitely
 		{
 			//no cars at either end, flagperson going to sleep, needs to wait for wakeup
-			if (full_north->value == 0 && full_south->value == 0)
+			if (full_north->value <= 0 && full_south->value <= 0)
 			{
 				if (!(*sleeping))
 				{
 					printf("The flagperson is now asleep.\n");
 					*sleeping = 1;
 				}
+				//sleep on the north lane, waking at least every FLAG_NAP_NS to look at the south lane
+				if (down_timeout(full_north, FLAG_NAP_NS) == 0)
+				{
+					up(full_north);					//only waiting for a car, the loop below takes it
+				}
 				continue;							//iterate again until new cars found
 			}
 			//cars to be taken from buffer
@@ -178,16 +184,14 @@ int main()
 
 			while (full_north->value > 0)
 			{
-				down(full_north);						//removing a resource
-				down(mutex);						//entering critical section
+				down_both(full_north, mutex);						//removing a resource and entering critical section
 				printf("Current consumer index for N: %d.\n", *cons_north);					//debugging
 				car = north_buf[(*cons_north % BUFFER_SIZE)];					//consume car from buffer
 				sleep(2);							//each car consumed takes 2s to go thru
 				printf("Car %d coming from the N direction left the construction zone at time %d.\n",
 				car, (int)time(NULL));
 				*cons_north = (*cons_north + 1) % BUFFER_SIZE;						//increment 'out'
-				up(mutex);							//exiting critical section
-				up(empty_north);							//new empty spot from consumption
+				up_both(mutex, empty_north);							//exiting critical section, new empty spot from consumption
 				if (full_south->value == 10)
 				{
 					break;									//need to switch to other side, queue full
@@ -196,16 +200,14 @@ int main()
 			//currently consuming in S and N not full (10), consume in S until empty or until S full
 			while (full_south->value > 0)
 			{
-				down(full_south);						//removing a resource
-				down(mutex);						//entering critical section
+				down_both(full_south, mutex);						//removing a resource and entering critical section
 				printf("Current consumer index for S: %d.\n", *cons_south);					//debugging
 				car = south_buf[(*cons_south % BUFFER_SIZE)];					//consume car from buffer
 				sleep(2);							//each car consumed takes 2s to go thru
 				printf("Car %d coming from the S direction left the construction zone at time %d.\n",
 				car, (int)time(NULL));
 				*cons_south = (*cons_south + 1) % BUFFER_SIZE;						//increment 'out'
-				up(mutex);							//exiting critical section
-				up(empty_south);							//new empty spot from consumption
+				up_both(mutex, empty_south);							//exiting critical section, new empty spot from consumption
 				if (full_north->value == 10)
 				{
 					break;									//need to switch to other side, queue full
@@ -332,10 +332,28 @@
 #define __NR_fallocate		324
 #define __NR_cs1550_down  325             //add down() and up() syscall nums for P2
 #define __NR_cs1550_up  326
+#define __NR_cs1550_semop  327          //batched down/up on several semaphores
+#define __NR_cs1550_trydown  328        //non-blocking and timed down
+#define __NR_cs1550_down_timeout  329
+#define __NR_cs1550_up_n  330           //release several units in one call
+#define __NR_cs1550_stats  331          //contention counters, also in /proc/cs1550_sem
+#define __NR_cs1550_create  332         //kernel-managed semaphores named by handle
+#define __NR_cs1550_destroy  333
+#define __NR_cs1550_down_handle  334
+#define __NR_cs1550_up_handle  335
+#define __NR_cs1550_down_read  336      //reader-writer semaphores
+#define __NR_cs1550_up_read  337
+#define __NR_cs1550_down_write  338
+#define __NR_cs1550_up_write  339
+#define __NR_cs1550_barrier_wait  340   //barriers and eventcounts
+#define __NR_cs1550_ec_await  341
+#define __NR_cs1550_ec_advance  342
+#define __NR_cs1550_up_down  343        //up one semaphore and down another atomically
+#define __NR_cs1550_sem_fd  344         //pollable fd for a kernel-managed semaphore
 
 #ifdef __KERNEL__
 
-#define NR_syscalls 325
+#define NR_syscalls 345
 
 #define __ARCH_WANT_IPC_PARSE_VERSION
 #define __ARCH_WANT_OLD_READDIR